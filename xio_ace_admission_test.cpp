@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Admission control check.
+ *
+ * Link with xio_ace_mock.cpp instead of libxio. Client sessions send
+ * requests to an XIO_Server with admission limits over the mock
+ * transport, the server holds the admitted requests until the check
+ * answers them. The check verifies that requests above the session and
+ * server limits are answered with the default busy response, that a
+ * session above the session limit is rejected and that answered
+ * requests release their share of the limits.
+ *
+ * Usage: xio_ace_admission_test
+ */
+
+#include "xio_ace_mock.h"
+#include "xio_ace_session.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <list>
+
+static int failures = 0;
+
+static void check (bool ok, const char* what)
+{
+  printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok)
+  {
+    ++failures;
+  }
+}
+
+////////////////////////////////////////////////////////
+///  Server
+////////////////////////////////////////////////////////
+class Test_Server : public XIO_Server
+{
+public:
+  static const XIO_Callback_Implementor::Callback cbs =
+    (XIO_Callback_Implementor::Callback) (XIO_Callback_Implementor::XIO_CB_ON_MSG |
+                                          XIO_Callback_Implementor::XIO_CB_ON_MSG_SEND_COMPLETE);
+
+  Test_Server ()
+  : XIO_Server (cbs)
+  {
+  }
+
+  virtual int on_msg (xio_session* session, xio_msg* msg, int more_in_batch)
+  {
+    this->held.push_back (msg);
+    return 0;
+  }
+
+  virtual int on_msg_send_complete (xio_session* session, xio_msg* msg)
+  {
+    delete msg;
+    return 0;
+  }
+
+  /// Answer the held requests
+  void answer ()
+  {
+    while (!this->held.empty ())
+    {
+      xio_msg* rsp = new xio_msg;
+      memset (rsp, 0, sizeof (xio_msg));
+      rsp->request = this->held.front ();
+      this->held.pop_front ();
+      xio_send_response (rsp);
+    }
+  }
+
+  std::deque <xio_msg*> held;
+};
+
+////////////////////////////////////////////////////////
+///  Client
+////////////////////////////////////////////////////////
+class Test_Session : public XIO_Reqeust_Session
+{
+public:
+  static const XIO_Callback_Implementor::Callback cbs =
+    (XIO_Callback_Implementor::Callback) (XIO_Callback_Implementor::XIO_CB_ON_MSG |
+                                          XIO_Callback_Implementor::XIO_CB_ON_SESSION_EVENT);
+
+  Test_Session ()
+  : XIO_Reqeust_Session (cbs)
+  , rejected (false)
+  {
+  }
+
+  virtual int on_session_event (xio_session* session, xio_session_event_data* data)
+  {
+    switch (data->event)
+    {
+    case XIO_SESSION_REJECT_EVENT:
+      this->rejected = true;
+      break;
+    case XIO_SESSION_TEARDOWN_EVENT:
+      this->close ();
+      break;
+    default:
+      break;
+    }
+    return 0;
+  }
+
+  bool rejected;
+};
+
+class Test_Connection : public XIO_Connection
+{
+public:
+  Test_Connection ()
+  : answered (0)
+  , busy (0)
+  {
+  }
+
+  void send ()
+  {
+    this->reqs_.push_back (xio_msg ());
+    xio_msg* req = &this->reqs_.back ();
+    memset (req, 0, sizeof (xio_msg));
+    this->send_request (req, false);
+  }
+
+  virtual int on_msg (xio_session* session, xio_msg* rsp, int more_in_batch)
+  {
+    if (XIO_Server::is_busy (rsp))
+    {
+      ++this->busy;
+    }
+    else
+    {
+      ++this->answered;
+    }
+    this->release_response (rsp);
+    return 0;
+  }
+
+  int answered;
+  int busy;
+
+private:
+  /// Requests stay valid until the connection goes away
+  std::list <xio_msg> reqs_;
+};
+
+/// Deliver all queued events
+static void settle (ACE_Reactor* reactor, xio_context* ctx)
+{
+  while (xio_ace_mock_pending (ctx) > 0)
+  {
+    reactor->handle_events ();
+  }
+}
+
+int main (int argc, char* argv[])
+{
+  ACE_Reactor* reactor = ACE_Reactor::instance ();
+  xio_context* ctx = xio_ace_ctx_open (reactor, 0);
+  if (ctx == NULL)
+  {
+    printf("Failed to open context\n");
+    return -1;
+  }
+
+  Test_Server server;
+  XIO_Server::Limits limits;
+  limits.max_sessions = 2;
+  limits.max_session_requests = 2;
+  limits.max_requests = 3;
+  server.limits (limits);
+  server.open (ctx, "mock://admission", NULL, 0);
+
+  Test_Session session_a;
+  session_a.open ("mock://admission", 0, 0, NULL, 0);
+  Test_Connection a;
+  a.open (&session_a, ctx, 0);
+  Test_Session session_b;
+  session_b.open ("mock://admission", 0, 0, NULL, 0);
+  Test_Connection b;
+  b.open (&session_b, ctx, 0);
+  settle (reactor, ctx);
+  check (server.load ().sessions == 2, "sessions admitted");
+
+  // A session above the limit is rejected
+  Test_Session session_c;
+  session_c.open ("mock://admission", 0, 0, NULL, 0);
+  Test_Connection c;
+  c.open (&session_c, ctx, 0);
+  settle (reactor, ctx);
+  check (session_c.rejected && server.load ().rejected_sessions == 1 &&
+         server.load ().sessions == 2, "session above the session limit rejected");
+  c.close ();
+
+  // Requests above the session limit are answered busy
+  a.send ();
+  a.send ();
+  a.send ();
+  settle (reactor, ctx);
+  check (server.held.size () == 2 && a.busy == 1, "request above the session limit busy");
+
+  // Requests above the server limit are answered busy
+  b.send ();
+  b.send ();
+  settle (reactor, ctx);
+  check (server.held.size () == 3 && b.busy == 1, "request above the server limit busy");
+  check (server.load ().requests == 3 && server.load ().rejected_requests == 2,
+         "busy responses accounted");
+
+  // Answered requests release the limits
+  server.answer ();
+  settle (reactor, ctx);
+  check (a.answered == 2 && b.answered == 1, "admitted requests answered");
+  check (server.load ().requests == 0, "no request outstanding");
+
+  a.send ();
+  b.send ();
+  settle (reactor, ctx);
+  check (server.held.size () == 2 && a.busy == 1 && b.busy == 1, "requests admitted again");
+  server.answer ();
+  settle (reactor, ctx);
+
+  a.close ();
+  session_a.close ();
+  b.close ();
+  session_b.close ();
+  settle (reactor, ctx);
+  server.close ();
+  xio_ctx_close (ctx);
+
+  printf("%s\n", failures == 0 ? "PASSED" : "FAILED");
+  return failures == 0 ? 0 : -1;
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "xio_ace_arena.h"
+#include "xio_ace_numa.h"
+
+#include <assert.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+////////////////////////////////////////////////////////
+///  XIO_Arena
+////////////////////////////////////////////////////////
+XIO_Arena::XIO_Arena ()
+: base_ (NULL)
+, capacity_ (0)
+, used_ (0)
+, page_size_ (PAGE_DEFAULT)
+, mr_ (NULL)
+{
+}
+
+XIO_Arena::~XIO_Arena ()
+{
+  if (this->base_)
+  {
+    this->close ();
+  }
+}
+
+int
+XIO_Arena::open (size_t size, Page_Size page_size, int numa_node)
+{
+  if (this->base_ || size == 0)
+  {
+    return -1;
+  }
+
+  // Try the requested page size first, then smaller ones
+  void* base = NULL;
+  size_t mapped_size = size;
+  for (int ps = page_size; ps <= PAGE_DEFAULT && base == NULL; ++ps)
+  {
+    mapped_size = size;
+    base = this->map (mapped_size, static_cast <Page_Size> (ps));
+    if (base)
+    {
+      this->page_size_ = static_cast <Page_Size> (ps);
+    }
+  }
+  if (base == NULL)
+  {
+    return -1;
+  }
+
+  // Place and fault in before registering
+  xio_ace_numa_bind (base, mapped_size, numa_node);
+  memset (base, 0, mapped_size);
+
+  this->mr_ = xio_reg_mr (base, mapped_size);
+  if (this->mr_ == NULL)
+  {
+    munmap (base, mapped_size);
+    return -1;
+  }
+
+  this->base_ = reinterpret_cast <char*> (base);
+  this->capacity_ = mapped_size;
+  this->used_ = 0;
+  return 0;
+}
+
+int
+XIO_Arena::close ()
+{
+  if (this->base_ == NULL)
+  {
+    return 0;
+  }
+
+  int retval = xio_dereg_mr (&this->mr_);
+  munmap (this->base_, this->capacity_);
+  this->base_ = NULL;
+  this->capacity_ = 0;
+  this->used_ = 0;
+  this->mr_ = NULL;
+  return retval;
+}
+
+void*
+XIO_Arena::allocate (size_t size, size_t alignment)
+{
+  assert ((alignment & (alignment - 1)) == 0);
+
+  size_t offset = (this->used_ + alignment - 1) & ~(alignment - 1);
+  if (this->base_ == NULL || offset > this->capacity_ || size > this->capacity_ - offset)
+  {
+    return NULL;
+  }
+
+  this->used_ = offset + size;
+  return this->base_ + offset;
+}
+
+bool
+XIO_Arena::contains (const void* addr) const
+{
+  const char* p = reinterpret_cast <const char*> (addr);
+  return p >= this->base_ && p < this->base_ + this->capacity_;
+}
+
+struct xio_mr*
+XIO_Arena::mr ()
+{
+  return this->mr_;
+}
+
+XIO_Arena::Page_Size
+XIO_Arena::page_size () const
+{
+  return this->page_size_;
+}
+
+size_t
+XIO_Arena::capacity () const
+{
+  return this->capacity_;
+}
+
+size_t
+XIO_Arena::used () const
+{
+  return this->used_;
+}
+
+void*
+XIO_Arena::map (size_t& size, Page_Size page_size)
+{
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  size_t page;
+  switch (page_size)
+  {
+  case PAGE_1GB:
+    page = 1UL << 30;
+    flags |= MAP_HUGETLB | MAP_HUGE_1GB;
+    break;
+  case PAGE_2MB:
+    page = 1UL << 21;
+    flags |= MAP_HUGETLB | MAP_HUGE_2MB;
+    break;
+  default:
+    page = sysconf (_SC_PAGESIZE);
+    break;
+  }
+
+  size = (size + page - 1) & ~(page - 1);
+  void* base = mmap (NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (base == MAP_FAILED)
+  {
+    return NULL;
+  }
+
+#ifdef MADV_HUGEPAGE
+  if (page_size == PAGE_DEFAULT)
+  {
+    // No reserved huge pages, let the kernel use transparent ones
+    madvise (base, size, MADV_HUGEPAGE);
+  }
+#endif
+  return base;
+}
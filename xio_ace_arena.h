@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XIO_ACE_ARENA_H
+#define XIO_ACE_ARENA_H
+
+#include <libxio.h>
+
+/**
+ * A registered memory arena backed by huge pages.
+ *
+ * The arena is mapped with 1GB or 2MB pages when the system has them
+ * reserved (falling back to smaller pages, and to regular pages with
+ * transparent huge pages advised) and registered once as a whole.
+ * Pools carve their memory from it, so all their buffers share one
+ * registration and few TLB entries. Allocation only moves forward,
+ * memory is returned when the arena is closed.
+ *
+ * An arena is not thread safe.
+ */
+class XIO_Arena
+{
+public:
+  /// Page sizes, in order of preference
+  enum Page_Size
+  {
+    PAGE_1GB,
+    PAGE_2MB,
+    PAGE_DEFAULT
+  };
+
+  XIO_Arena ();
+  virtual ~XIO_Arena ();
+
+  /**
+   * Map, fault in and register the arena
+   *
+   * @param size Size in bytes, rounded up to the page size used
+   * @param page_size Largest page size to try
+   * @param numa_node Node to place the arena on, -1 for the node of the
+   *                  opening thread
+   *
+   * @return 0 on success, -1 upon error
+   */
+  int open (size_t size, Page_Size page_size, int numa_node = -1);
+
+  /// Deregister and unmap the arena
+  int close ();
+
+  /**
+   * Carve memory from the arena
+   *
+   * @param size Size in bytes
+   * @param alignment Alignment, a power of 2
+   *
+   * @return The memory, or NULL if the arena is full
+   */
+  void* allocate (size_t size, size_t alignment = 64);
+
+  /// Whether an address belongs to the arena
+  bool contains (const void* addr) const;
+
+  /// Accessor to the registration covering the whole arena
+  struct xio_mr* mr ();
+  /// The page size actually used
+  Page_Size page_size () const;
+  /// Size of the arena in bytes
+  size_t capacity () const;
+  /// Bytes allocated so far
+  size_t used () const;
+
+private:
+  /// Try to map size bytes with the given page size
+  void* map (size_t& size, Page_Size page_size);
+
+  char* base_;
+  size_t capacity_;
+  size_t used_;
+  Page_Size page_size_;
+  struct xio_mr* mr_;
+};
+
+#endif // XIO_ACE_ARENA_H
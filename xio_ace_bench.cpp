@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Wrapper dispatch microbenchmark.
+ *
+ * Link with xio_ace_mock.cpp instead of libxio. The same request /
+ * response ping-pong runs twice over the mock transport on one reactor:
+ * with plain accelio callbacks and through XIO_Server,
+ * XIO_Reqeust_Session and XIO_Connection. Both pay the same transport
+ * cost, the difference per callback is the overhead of the wrappers.
+ * Every request takes three callbacks: on_msg on the server,
+ * on_msg_send_complete on the server and on_msg on the client.
+ *
+ * Each variant runs ROUNDS times and the fastest run counts, which
+ * keeps scheduling noise out of the comparison. The wrapped run may be
+ * slower than the raw run by max_overhead_percent at most, otherwise
+ * the benchmark fails (exits with -1); 0 disables the check.
+ *
+ * Usage: xio_ace_bench [requests] [window] [max_overhead_percent]
+ */
+
+#include "xio_ace_mock.h"
+#include "xio_ace_session.h"
+#include "xio_ace_trace.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+static const int CALLBACKS_PER_REQUEST = 3;
+static const int ROUNDS = 3;
+
+/// Progress of a run, shared by both variants
+struct Bench_State
+{
+  Bench_State (long requests, int window)
+  : requests (requests)
+  , sent (0)
+  , completed (0)
+  , conn (NULL)
+  , reqs (window)
+  {
+    memset (&reqs[0], 0, sizeof (xio_msg) * reqs.size ());
+  }
+
+  ~Bench_State ()
+  {
+    for (size_t i = 0; i < free_rsps.size (); ++i)
+    {
+      delete free_rsps[i];
+    }
+  }
+
+  /// A response for a server request
+  xio_msg* get_response (xio_msg* req)
+  {
+    xio_msg* rsp;
+    if (free_rsps.empty ())
+    {
+      rsp = new xio_msg;
+    }
+    else
+    {
+      rsp = free_rsps.back ();
+      free_rsps.pop_back ();
+    }
+    memset (rsp, 0, sizeof (xio_msg));
+    rsp->request = req;
+    return rsp;
+  }
+
+  void put_response (xio_msg* rsp)
+  {
+    free_rsps.push_back (rsp);
+  }
+
+  bool done () const
+  {
+    return this->completed == this->requests;
+  }
+
+  long requests;
+  long sent;
+  long completed;
+  xio_connection* conn;
+  std::vector <xio_msg> reqs;
+  std::vector <xio_msg*> free_rsps;
+};
+
+////////////////////////////////////////////////////////
+///  Plain accelio callbacks
+////////////////////////////////////////////////////////
+static int raw_on_new_session (xio_session* session, xio_new_session_req* req, void* ctx)
+{
+  xio_accept (session, NULL, 0, NULL, 0);
+  return 0;
+}
+
+static int raw_server_on_msg (xio_session* session, xio_msg* msg, int more_in_batch, void* ctx)
+{
+  Bench_State* state = reinterpret_cast <Bench_State*> (ctx);
+  xio_send_response (state->get_response (msg));
+  return 0;
+}
+
+static int raw_server_send_complete (xio_session* session, xio_msg* msg, void* ctx)
+{
+  Bench_State* state = reinterpret_cast <Bench_State*> (ctx);
+  state->put_response (msg);
+  return 0;
+}
+
+static int raw_client_on_msg (xio_session* session, xio_msg* rsp, int more_in_batch, void* ctx)
+{
+  Bench_State* state = reinterpret_cast <Bench_State*> (ctx);
+  xio_msg* req = rsp->request;
+  xio_release_response (rsp);
+  ++state->completed;
+  if (state->sent < state->requests)
+  {
+    ++state->sent;
+    xio_send_request (state->conn, req);
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////
+///  Wrappers
+////////////////////////////////////////////////////////
+class Bench_Server : public XIO_Server
+{
+public:
+  static const XIO_Callback_Implementor::Callback cbs =
+    (XIO_Callback_Implementor::Callback) (XIO_Callback_Implementor::XIO_CB_ON_NEW_SESSION |
+                                          XIO_Callback_Implementor::XIO_CB_ON_MSG |
+                                          XIO_Callback_Implementor::XIO_CB_ON_MSG_SEND_COMPLETE);
+
+  Bench_Server (Bench_State& state)
+  : XIO_Server (cbs)
+  , state_ (state)
+  {
+  }
+
+  virtual int on_new_session (xio_session* session, xio_new_session_req* req)
+  {
+    xio_accept (session, NULL, 0, NULL, 0);
+    return 0;
+  }
+
+  virtual int on_msg (xio_session* session, xio_msg* msg, int more_in_batch)
+  {
+    this->send_response (session, this->state_.get_response (msg));
+    return 0;
+  }
+
+  virtual int on_msg_send_complete (xio_session* session, xio_msg* msg)
+  {
+    this->state_.put_response (msg);
+    return 0;
+  }
+
+private:
+  Bench_State& state_;
+};
+
+class Bench_Session : public XIO_Reqeust_Session
+{
+public:
+  Bench_Session ()
+  : XIO_Reqeust_Session (XIO_Callback_Implementor::XIO_CB_ON_MSG)
+  {
+  }
+};
+
+class Bench_Connection : public XIO_Connection
+{
+public:
+  Bench_Connection (Bench_State& state)
+  : state_ (state)
+  {
+  }
+
+  virtual int on_msg (xio_session* session, xio_msg* rsp, int more_in_batch)
+  {
+    xio_msg* req = rsp->request;
+    this->release_response (rsp);
+    ++this->state_.completed;
+    if (this->state_.sent < this->state_.requests)
+    {
+      ++this->state_.sent;
+      this->send_request (req, false);
+    }
+    return 0;
+  }
+
+private:
+  Bench_State& state_;
+};
+
+////////////////////////////////////////////////////////
+///  Runs
+////////////////////////////////////////////////////////
+/// Send the first window of requests
+static void start (Bench_State& state, XIO_Connection* conn)
+{
+  for (size_t i = 0; i < state.reqs.size () && state.sent < state.requests; ++i)
+  {
+    ++state.sent;
+    if (conn)
+    {
+      conn->send_request (&state.reqs[i], false);
+    }
+    else
+    {
+      xio_send_request (state.conn, &state.reqs[i]);
+    }
+  }
+}
+
+/// Run the reactor until all requests completed, return the elapsed ns
+static uint64_t run (ACE_Reactor* reactor, Bench_State& state, XIO_Connection* conn)
+{
+  uint64_t begin = xio_ace_trace_now ();
+  start (state, conn);
+  while (!state.done ())
+  {
+    reactor->handle_events ();
+  }
+  return xio_ace_trace_now () - begin;
+}
+
+/// Deliver the close events before the callback objects go away
+static void drain (ACE_Reactor* reactor, xio_context* ctx)
+{
+  while (xio_ace_mock_pending (ctx) > 0)
+  {
+    reactor->handle_events ();
+  }
+}
+
+static uint64_t run_raw (ACE_Reactor* reactor, xio_context* ctx, long requests, int window)
+{
+  Bench_State state (requests, window);
+
+  xio_session_ops server_ops;
+  memset (&server_ops, 0, sizeof (server_ops));
+  server_ops.on_new_session = raw_on_new_session;
+  server_ops.on_msg = raw_server_on_msg;
+  server_ops.on_msg_send_complete = raw_server_send_complete;
+  xio_server* server = xio_bind (ctx, &server_ops, "mock://raw", NULL, 0, &state);
+
+  xio_session_ops client_ops;
+  memset (&client_ops, 0, sizeof (client_ops));
+  client_ops.on_msg = raw_client_on_msg;
+  xio_session_attr attr;
+  memset (&attr, 0, sizeof (attr));
+  attr.ses_ops = &client_ops;
+  xio_session* session = xio_session_open (XIO_SESSION_REQ, &attr, "mock://raw", 0, 0, &state);
+  state.conn = xio_connect (session, ctx, 0, &state);
+
+  uint64_t elapsed = run (reactor, state, NULL);
+
+  xio_session_close (session);
+  drain (reactor, ctx);
+  xio_unbind (server);
+  return elapsed;
+}
+
+static uint64_t run_wrapped (ACE_Reactor* reactor, xio_context* ctx, long requests, int window)
+{
+  Bench_State state (requests, window);
+
+  Bench_Server server (state);
+  server.open (ctx, "mock://wrapped", NULL, 0);
+
+  Bench_Session session;
+  session.open ("mock://wrapped", 0, 0, NULL, 0);
+  Bench_Connection conn (state);
+  conn.open (&session, ctx, 0);
+
+  uint64_t elapsed = run (reactor, state, &conn);
+
+  conn.close ();
+  session.close ();
+  drain (reactor, ctx);
+  server.close ();
+  return elapsed;
+}
+
+int main (int argc, char* argv[])
+{
+  long requests = argc > 1 ? atol (argv[1]) : 1000000;
+  int window = argc > 2 ? atoi (argv[2]) : 16;
+  double max_overhead_percent = argc > 3 ? atof (argv[3]) : 50.0;
+  if (requests <= 0 || window <= 0 || max_overhead_percent < 0)
+  {
+    printf("Usage: %s [requests] [window] [max_overhead_percent]\n", argv[0]);
+    return -1;
+  }
+
+  ACE_Reactor* reactor = ACE_Reactor::instance ();
+  xio_context* ctx = xio_ace_ctx_open (reactor, 0);
+  if (ctx == NULL)
+  {
+    printf("Failed to open context\n");
+    return -1;
+  }
+
+  // Warm up both paths, then measure
+  run_raw (reactor, ctx, window * 100, window);
+  run_wrapped (reactor, ctx, window * 100, window);
+  uint64_t raw = 0;
+  uint64_t wrapped = 0;
+  for (int i = 0; i < ROUNDS; ++i)
+  {
+    uint64_t elapsed = run_raw (reactor, ctx, requests, window);
+    raw = i == 0 ? elapsed : std::min (raw, elapsed);
+    elapsed = run_wrapped (reactor, ctx, requests, window);
+    wrapped = i == 0 ? elapsed : std::min (wrapped, elapsed);
+  }
+
+  double callbacks = static_cast <double> (requests) * CALLBACKS_PER_REQUEST;
+  double overhead = ((double) wrapped - (double) raw) / callbacks;
+  double percent = 100.0 * overhead / (raw / callbacks);
+  printf("requests: %ld, window: %d\n", requests, window);
+  printf("raw:      %8.1f ns/request %8.1f ns/callback\n", raw / (double) requests, raw / callbacks);
+  printf("wrapped:  %8.1f ns/request %8.1f ns/callback\n", wrapped / (double) requests, wrapped / callbacks);
+  printf("overhead: %8.1f ns/callback (%.1f%%)\n", overhead, percent);
+
+  xio_ctx_close (ctx);
+
+  if (max_overhead_percent > 0 && percent > max_overhead_percent)
+  {
+    printf("FAILED: overhead above %g%%\n", max_overhead_percent);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "xio_ace_bulk_connect.h"
+
+////////////////////////////////////////////////////////
+///  XIO_Bulk_Connector
+////////////////////////////////////////////////////////
+XIO_Bulk_Connector::XIO_Bulk_Connector (const Options& options)
+: options_ (options)
+, remaining_ (0)
+, ready_ (0)
+, failed_ (0)
+{
+}
+
+XIO_Bulk_Connector::~XIO_Bulk_Connector ()
+{
+  for (size_t i = 0; i < this->targets_.size (); ++i)
+  {
+    Target_State* state = this->targets_[i];
+    state->target.reactor->purge_pending_notifications (state);
+    for (size_t c = 0; c < state->connections.size (); ++c)
+    {
+      delete state->connections[c];
+    }
+    delete state->session;
+    delete state->pool;
+    delete state;
+  }
+}
+
+int
+XIO_Bulk_Connector::start (const std::vector <Target>& targets)
+{
+  if (!this->targets_.empty ())
+  {
+    return -1;
+  }
+
+  // on_complete fires when the last connection is done, there must be one
+  long total = 0;
+  for (size_t i = 0; i < targets.size (); ++i)
+  {
+    if (targets[i].connections < 0)
+    {
+      return -1;
+    }
+    total += targets[i].connections;
+  }
+  if (total == 0)
+  {
+    return -1;
+  }
+
+  // Create every object up front, the target threads only look them up
+  for (size_t i = 0; i < targets.size (); ++i)
+  {
+    Target_State* state = new Target_State;
+    state->connector = this;
+    state->target = targets[i];
+    state->session = this->create_session (targets[i]);
+    state->pool = NULL;
+    for (int c = 0; c < targets[i].connections; ++c)
+    {
+      XIO_Connection* conn = this->create_connection (targets[i]);
+      state->connections.push_back (conn);
+      state->pending[conn] = CONNECTING;
+    }
+    this->targets_.push_back (state);
+    this->sessions_[state->session] = state;
+  }
+  this->remaining_ = total;
+
+  int retval = 0;
+  for (size_t i = 0; i < this->targets_.size (); ++i)
+  {
+    Target_State* state = this->targets_[i];
+    if (state->target.reactor->notify (state, ACE_Event_Handler::EXCEPT_MASK) != 0)
+    {
+      for (size_t c = 0; c < state->connections.size (); ++c)
+      {
+        this->connection_failed (state, state->connections[c]);
+      }
+      retval = -1;
+    }
+  }
+  return retval;
+}
+
+void
+XIO_Bulk_Connector::on_session_event (XIO_Reqeust_Session* session, xio_session_event_data* data)
+{
+  Session_Map::iterator it = this->sessions_.find (session);
+  if (it == this->sessions_.end ())
+  {
+    return;
+  }
+
+  Target_State* state = it->second;
+  XIO_Connection* conn = reinterpret_cast <XIO_Connection*> (data->conn_user_context);
+
+  switch (data->event)
+  {
+  case XIO_SESSION_CONNECTION_ESTABLISHED_EVENT:
+    this->connection_ready (state, conn);
+    break;
+  case XIO_SESSION_CONNECTION_REFUSED_EVENT:
+  case XIO_SESSION_CONNECTION_ERROR_EVENT:
+  case XIO_SESSION_CONNECTION_DISCONNECTED_EVENT:
+  case XIO_SESSION_CONNECTION_CLOSED_EVENT:
+    this->connection_failed (state, conn);
+    break;
+  case XIO_SESSION_REJECT_EVENT:
+  case XIO_SESSION_TEARDOWN_EVENT:
+    for (size_t c = 0; c < state->connections.size (); ++c)
+    {
+      this->connection_failed (state, state->connections[c]);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+bool
+XIO_Bulk_Connector::on_msg (xio_msg* rsp)
+{
+  if (rsp->request == NULL || rsp->request->user_context != this)
+  {
+    return false;
+  }
+
+  // msg is the first member of Warmup
+  Warmup* warmup = reinterpret_cast <Warmup*> (rsp->request);
+  Target_State* state = warmup->target;
+  XIO_Connection* conn = warmup->conn;
+  xio_release_response (rsp);
+  delete warmup;
+
+  std::map <XIO_Connection*, long>::iterator it = state->pending.find (conn);
+  if (it != state->pending.end () && it->second > 0 && --it->second == 0)
+  {
+    state->pending.erase (it);
+    this->connection_done (true);
+  }
+  return true;
+}
+
+bool
+XIO_Bulk_Connector::on_msg_error (xio_msg* msg)
+{
+  if (msg->user_context != this)
+  {
+    return false;
+  }
+
+  Warmup* warmup = reinterpret_cast <Warmup*> (msg);
+  Target_State* state = warmup->target;
+  XIO_Connection* conn = warmup->conn;
+  delete warmup;
+
+  this->connection_failed (state, conn);
+  return true;
+}
+
+size_t
+XIO_Bulk_Connector::size () const
+{
+  return this->targets_.size ();
+}
+
+XIO_Reqeust_Session*
+XIO_Bulk_Connector::session (size_t target)
+{
+  return this->targets_[target]->session;
+}
+
+const std::vector <XIO_Connection*>&
+XIO_Bulk_Connector::connections (size_t target)
+{
+  return this->targets_[target]->connections;
+}
+
+XIO_Buffer_Pool*
+XIO_Bulk_Connector::pool (size_t target)
+{
+  return this->targets_[target]->pool;
+}
+
+void
+XIO_Bulk_Connector::open_target (Target_State* state)
+{
+  // Registered (and touched) on the context's thread
+  if (this->options_.buffer_size > 0 && this->options_.buffer_count > 0)
+  {
+    state->pool = new XIO_Buffer_Pool;
+    if (state->pool->open (this->options_.buffer_size, this->options_.buffer_count) != 0)
+    {
+      delete state->pool;
+      state->pool = NULL;
+    }
+  }
+
+  if (state->session->open (state->target.uri, 0, 0, NULL, 0) == NULL)
+  {
+    for (size_t c = 0; c < state->connections.size (); ++c)
+    {
+      this->connection_failed (state, state->connections[c]);
+    }
+    return;
+  }
+
+  for (size_t c = 0; c < state->connections.size (); ++c)
+  {
+    XIO_Connection* conn = state->connections[c];
+    if (conn->open (state->session, state->target.ctx, 0) == NULL)
+    {
+      this->connection_failed (state, conn);
+    }
+  }
+}
+
+void
+XIO_Bulk_Connector::connection_ready (Target_State* state, XIO_Connection* conn)
+{
+  std::map <XIO_Connection*, long>::iterator it = state->pending.find (conn);
+  if (it == state->pending.end () || it->second != CONNECTING)
+  {
+    return;
+  }
+
+  long sent = 0;
+  for (size_t i = 0; i < this->options_.warmup_requests; ++i)
+  {
+    Warmup* warmup = new Warmup;
+    memset (&warmup->msg, 0, sizeof (xio_msg));
+    // Tags the message as ours, see on_msg ()
+    warmup->msg.user_context = this;
+    warmup->target = state;
+    warmup->conn = conn;
+    if (xio_send_request (conn->connection (), &warmup->msg) != 0)
+    {
+      delete warmup;
+      break;
+    }
+    ++sent;
+  }
+
+  if (sent == 0)
+  {
+    state->pending.erase (it);
+    this->connection_done (true);
+    return;
+  }
+  it->second = sent;
+}
+
+void
+XIO_Bulk_Connector::connection_failed (Target_State* state, XIO_Connection* conn)
+{
+  std::map <XIO_Connection*, long>::iterator it = state->pending.find (conn);
+  if (it == state->pending.end ())
+  {
+    return;
+  }
+
+  // Outstanding warm-ups are freed by on_msg_error
+  state->pending.erase (it);
+  this->connection_done (false);
+}
+
+void
+XIO_Bulk_Connector::connection_done (bool ready)
+{
+  if (ready)
+  {
+    ++this->ready_;
+  }
+  else
+  {
+    ++this->failed_;
+  }
+
+  if (--this->remaining_ == 0)
+  {
+    this->on_complete (this->ready_.value (), this->failed_.value ());
+  }
+}
+
+int
+XIO_Bulk_Connector::Target_State::handle_exception (ACE_HANDLE fd)
+{
+  this->connector->open_target (this);
+  return 0;
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XIO_ACE_BULK_CONNECT_H
+#define XIO_ACE_BULK_CONNECT_H
+
+#include "xio_ace_session.h"
+#include "xio_ace_pool.h"
+
+#include <ace/Atomic_Op.h>
+#include <ace/Event_Handler.h>
+#include <ace/Thread_Mutex.h>
+
+#include <map>
+#include <vector>
+
+/**
+ * Opens many sessions and connections concurrently.
+ *
+ * Every target is opened on the thread running its context's reactor
+ * (through a reactor notification), so targets on different contexts
+ * connect in parallel and nothing waits for a previous session to be
+ * established. Optionally a registered buffer pool is created on each
+ * target's thread and a number of warm-up requests are sent on every
+ * new connection. on_complete is called once, when every connection was
+ * established (and warmed up) or failed.
+ *
+ * Sessions created by create_session forward their on_session_event
+ * to the connector, connections forward their on_msg and on_msg_error.
+ */
+class XIO_Bulk_Connector
+{
+public:
+  /// A server to connect to
+  struct Target
+  {
+    /// The uri to connect
+    const char* uri;
+    /// Context handle the connections are opened on
+    struct xio_context* ctx;
+    /// The reactor running ctx
+    ACE_Reactor* reactor;
+    /// Number of connections to open in the session
+    int connections;
+  };
+
+  /// Optional preparation of every target
+  struct Options
+  {
+    /// Number of empty requests sent on every new connection
+    size_t warmup_requests;
+    /// Size of the buffers of the per target pool (0 - no pool)
+    size_t buffer_size;
+    /// Number of buffers in the per target pool
+    size_t buffer_count;
+  };
+
+  XIO_Bulk_Connector (const Options& options);
+  virtual ~XIO_Bulk_Connector ();
+
+  /**
+   * Start connecting.
+   * May be called once. The targets are opened asynchronously.
+   *
+   * @return 0 on success, -1 if there is no connection to open or a
+   *         target could not be scheduled
+   */
+  int start (const std::vector <Target>& targets);
+
+  /**
+   * Handle a session event of a session created by the connector.
+   * The event should be handled by the caller as well.
+   */
+  void on_session_event (XIO_Reqeust_Session* session, xio_session_event_data* data);
+
+  /**
+   * Handle a response
+   *
+   * @return true if the response was a warm-up response (and was
+   *         released), false if it should be handled by the caller
+   */
+  bool on_msg (xio_msg* rsp);
+
+  /**
+   * Handle a send error
+   *
+   * @return true if the message was a warm-up request (and was freed),
+   *         false if it should be handled by the caller
+   */
+  bool on_msg_error (xio_msg* msg);
+
+  /// Number of targets
+  size_t size () const;
+  /// Accessor to the session of a target (NULL before start)
+  XIO_Reqeust_Session* session (size_t target);
+  /// Accessor to the connections of a target
+  const std::vector <XIO_Connection*>& connections (size_t target);
+  /// Accessor to the buffer pool of a target (NULL without a pool)
+  XIO_Buffer_Pool* pool (size_t target);
+
+protected:
+  /// Create (but do not open) a session
+  virtual XIO_Reqeust_Session* create_session (const Target& target) = 0;
+  /// Create (but do not open) a connection
+  virtual XIO_Connection* create_connection (const Target& target) = 0;
+
+  /**
+   * Called once when all connections are ready or failed.
+   * Called on the thread of the context that finished last.
+   *
+   * @param ready Number of established connections
+   * @param failed Number of connections that failed
+   */
+  virtual void on_complete (size_t ready, size_t failed) = 0;
+
+private:
+  struct Target_State;
+
+  /// A warm-up request, msg must stay the first member
+  struct Warmup
+  {
+    xio_msg msg;
+    Target_State* target;
+    XIO_Connection* conn;
+  };
+
+  /// Opens a target on its reactor's thread
+  struct Target_State : public ACE_Event_Handler
+  {
+    XIO_Bulk_Connector* connector;
+    Target target;
+    XIO_Reqeust_Session* session;
+    std::vector <XIO_Connection*> connections;
+    /// Connections not done yet: CONNECTING or number of warm-ups left
+    std::map <XIO_Connection*, long> pending;
+    XIO_Buffer_Pool* pool;
+
+    virtual int handle_exception (ACE_HANDLE fd);
+  };
+
+  typedef std::map <XIO_Reqeust_Session*, Target_State*> Session_Map;
+
+  enum { CONNECTING = -1 };
+
+  /// Open the session, connections and pool of a target
+  void open_target (Target_State* state);
+  /// A connection is established, warm it up
+  void connection_ready (Target_State* state, XIO_Connection* conn);
+  /// A pending connection failed
+  void connection_failed (Target_State* state, XIO_Connection* conn);
+  /// A connection is ready or failed
+  void connection_done (bool ready);
+
+  Options options_;
+  std::vector <Target_State*> targets_;
+  /// Written by start before the targets are opened, read only afterwards
+  Session_Map sessions_;
+  ACE_Atomic_Op <ACE_Thread_Mutex, long> remaining_;
+  ACE_Atomic_Op <ACE_Thread_Mutex, long> ready_;
+  ACE_Atomic_Op <ACE_Thread_Mutex, long> failed_;
+};
+
+#endif // XIO_ACE_BULK_CONNECT_H
@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "xio_ace_cache.h"
+
+#include <ace/OS_NS_sys_time.h>
+
+#include <assert.h>
+#include <string.h>
+
+/// Bytes of the header and data vectors of a message
+static size_t vmsg_size (const xio_vmsg& vmsg)
+{
+  size_t len = vmsg.header.iov_len;
+  for (size_t i = 0; i < vmsg.data_iovlen; ++i)
+  {
+    len += vmsg.data_iov[i].iov_len;
+  }
+  return len;
+}
+
+/// Hash a word at a time
+static uint64_t mix (uint64_t h, const void* data, size_t len)
+{
+  const unsigned char* bytes = reinterpret_cast <const unsigned char*> (data);
+  uint64_t word;
+  while (len >= sizeof (word))
+  {
+    memcpy (&word, bytes, sizeof (word));
+    h = (h ^ word) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+    bytes += sizeof (word);
+    len -= sizeof (word);
+  }
+
+  word = 0;
+  memcpy (&word, bytes, len);
+  h = (h ^ word ^ (static_cast <uint64_t> (len) << 56)) * 0x9e3779b97f4a7c15ULL;
+  return h ^ (h >> 29);
+}
+
+////////////////////////////////////////////////////////
+///  XIO_Response_Cache
+////////////////////////////////////////////////////////
+XIO_Response_Cache::XIO_Response_Cache (size_t max_entries,
+                                        size_t max_bytes,
+                                        const ACE_Time_Value& ttl,
+                                        size_t max_request_size)
+: max_entries_ (max_entries)
+, max_bytes_ (max_bytes)
+, ttl_ (ttl)
+, max_request_size_ (max_request_size)
+, hand_ (0)
+, bytes_ (0)
+{
+  // A power of two at least twice the entries, chains stay short
+  size_t buckets = 16;
+  while (buckets < max_entries * 2)
+  {
+    buckets *= 2;
+  }
+  this->buckets_.resize (buckets, (Entry*) NULL);
+  memset (&this->stats_, 0, sizeof (this->stats_));
+}
+
+XIO_Response_Cache::~XIO_Response_Cache ()
+{
+  this->clear ();
+  for (Pending::iterator it = this->pending_.begin (); it != this->pending_.end (); ++it)
+  {
+    delete it->second;
+  }
+  for (size_t i = 0; i < this->free_responses_.size (); ++i)
+  {
+    delete this->free_responses_[i];
+  }
+}
+
+XIO_Response_Cache::Lookup
+XIO_Response_Cache::lookup (xio_session* session, xio_msg* req)
+{
+  size_t size = vmsg_size (req->in);
+  if (size > this->max_request_size_)
+  {
+    return BYPASS;
+  }
+
+  Request request = { session, req };
+  uint64_t h = hash (req);
+  Entry* entry = this->find (h, req);
+  if (entry && entry->response == NULL)
+  {
+    entry->waiting.push_back (request);
+    ++this->stats_.collapsed;
+    return COLLAPSED;
+  }
+
+  if (entry && this->ttl_ > ACE_Time_Value::zero && entry->expires <= ACE_OS::gettimeofday ())
+  {
+    this->remove (entry);
+    ++this->stats_.expirations;
+    entry = NULL;
+  }
+
+  if (entry)
+  {
+    entry->referenced = true;
+    if (this->send (request, entry) != 0)
+    {
+      return BYPASS;
+    }
+    ++this->stats_.hits;
+    return HIT;
+  }
+
+  entry = new Entry;
+  entry->hash = h;
+  entry->key.reserve (size);
+  entry->key.append (reinterpret_cast <const char*> (req->in.header.iov_base), req->in.header.iov_len);
+  for (size_t i = 0; i < req->in.data_iovlen; ++i)
+  {
+    entry->key.append (reinterpret_cast <const char*> (req->in.data_iov[i].iov_base),
+                       req->in.data_iov[i].iov_len);
+  }
+  entry->key_header_len = req->in.header.iov_len;
+  entry->response = NULL;
+  entry->header_len = 0;
+  entry->referenced = false;
+  entry->slot = 0;
+  entry->leader = request;
+
+  Entry*& bucket = this->buckets_[h & (this->buckets_.size () - 1)];
+  entry->next = bucket;
+  bucket = entry;
+  this->pending_[req] = entry;
+  ++this->stats_.misses;
+  return MISS;
+}
+
+int
+XIO_Response_Cache::store (xio_msg* rsp, std::vector <Request>& failed)
+{
+  Pending::iterator it = this->pending_.find (rsp->request);
+  if (it == this->pending_.end ())
+  {
+    return -1;
+  }
+  Entry* entry = it->second;
+
+  size_t size = vmsg_size (rsp->out);
+  XIO_Shared_Buffer* buffer = XIO_Shared_Buffer::create (size > 0 ? size : 1);
+  if (buffer == NULL)
+  {
+    return -1;
+  }
+
+  char* p = reinterpret_cast <char*> (buffer->data ());
+  memcpy (p, rsp->out.header.iov_base, rsp->out.header.iov_len);
+  p += rsp->out.header.iov_len;
+  for (size_t i = 0; i < rsp->out.data_iovlen; ++i)
+  {
+    memcpy (p, rsp->out.data_iov[i].iov_base, rsp->out.data_iov[i].iov_len);
+    p += rsp->out.data_iov[i].iov_len;
+  }
+  buffer->length (size);
+
+  this->pending_.erase (it);
+  entry->response = buffer;
+  entry->header_len = rsp->out.header.iov_len;
+  if (this->ttl_ > ACE_Time_Value::zero)
+  {
+    entry->expires = ACE_OS::gettimeofday () + this->ttl_;
+  }
+  entry->leader.msg = NULL;
+  entry->slot = this->clock_.size ();
+  this->clock_.push_back (entry);
+  this->bytes_ += size;
+
+  std::vector <Request> waiting;
+  waiting.swap (entry->waiting);
+  for (size_t i = 0; i < waiting.size (); ++i)
+  {
+    if (this->send (waiting[i], entry) != 0)
+    {
+      failed.push_back (waiting[i]);
+    }
+  }
+
+  this->evict ();
+  return 0;
+}
+
+bool
+XIO_Response_Cache::abandon (xio_msg* req, Request& next)
+{
+  Pending::iterator it = this->pending_.find (req);
+  if (it == this->pending_.end ())
+  {
+    return false;
+  }
+  Entry* entry = it->second;
+  this->pending_.erase (it);
+
+  if (entry->waiting.empty ())
+  {
+    this->unlink (entry);
+    delete entry;
+    return false;
+  }
+
+  // The first collapsed request takes over the computation
+  next = entry->waiting.front ();
+  entry->waiting.erase (entry->waiting.begin ());
+  entry->leader = next;
+  this->pending_[next.msg] = entry;
+  return true;
+}
+
+void
+XIO_Response_Cache::purge (xio_session* session, std::vector <Request>& next)
+{
+  std::vector <Entry*> entries;
+  for (Pending::iterator it = this->pending_.begin (); it != this->pending_.end (); ++it)
+  {
+    entries.push_back (it->second);
+  }
+
+  for (size_t i = 0; i < entries.size (); ++i)
+  {
+    Entry* entry = entries[i];
+    std::vector <Request>& waiting = entry->waiting;
+    for (std::vector <Request>::iterator it = waiting.begin (); it != waiting.end (); )
+    {
+      it = it->session == session ? waiting.erase (it) : it + 1;
+    }
+
+    if (entry->leader.session == session)
+    {
+      Request promoted;
+      if (this->abandon (entry->leader.msg, promoted))
+      {
+        next.push_back (promoted);
+      }
+    }
+  }
+}
+
+bool
+XIO_Response_Cache::complete (xio_msg* msg)
+{
+  if (msg == NULL || msg->user_context != this)
+  {
+    return false;
+  }
+
+  // msg is the first member of Cached_Response
+  Cached_Response* rsp = reinterpret_cast <Cached_Response*> (msg);
+  rsp->buffer->release ();
+  this->free_responses_.push_back (rsp);
+  return true;
+}
+
+void
+XIO_Response_Cache::clear ()
+{
+  while (!this->clock_.empty ())
+  {
+    this->remove (this->clock_.back ());
+  }
+  this->hand_ = 0;
+}
+
+size_t
+XIO_Response_Cache::size () const
+{
+  return this->clock_.size ();
+}
+
+size_t
+XIO_Response_Cache::bytes () const
+{
+  return this->bytes_;
+}
+
+const XIO_Response_Cache::Stats&
+XIO_Response_Cache::stats () const
+{
+  return this->stats_;
+}
+
+uint64_t
+XIO_Response_Cache::hash (const xio_msg* req)
+{
+  // The header length is hashed in, so is the split of the key
+  uint64_t h = mix (14695981039346656037ULL, req->in.header.iov_base, req->in.header.iov_len);
+  for (size_t i = 0; i < req->in.data_iovlen; ++i)
+  {
+    h = mix (h, req->in.data_iov[i].iov_base, req->in.data_iov[i].iov_len);
+  }
+  return h;
+}
+
+bool
+XIO_Response_Cache::matches (const Entry* entry, const xio_msg* req)
+{
+  if (entry->key_header_len != req->in.header.iov_len ||
+      entry->key.size () != vmsg_size (req->in))
+  {
+    return false;
+  }
+
+  const char* key = entry->key.data ();
+  if (memcmp (key, req->in.header.iov_base, req->in.header.iov_len) != 0)
+  {
+    return false;
+  }
+  key += req->in.header.iov_len;
+  for (size_t i = 0; i < req->in.data_iovlen; ++i)
+  {
+    if (memcmp (key, req->in.data_iov[i].iov_base, req->in.data_iov[i].iov_len) != 0)
+    {
+      return false;
+    }
+    key += req->in.data_iov[i].iov_len;
+  }
+  return true;
+}
+
+XIO_Response_Cache::Entry*
+XIO_Response_Cache::find (uint64_t hash, const xio_msg* req)
+{
+  Entry* entry = this->buckets_[hash & (this->buckets_.size () - 1)];
+  while (entry && (entry->hash != hash || !matches (entry, req)))
+  {
+    entry = entry->next;
+  }
+  return entry;
+}
+
+void
+XIO_Response_Cache::unlink (Entry* entry)
+{
+  Entry** link = &this->buckets_[entry->hash & (this->buckets_.size () - 1)];
+  while (*link != entry)
+  {
+    assert (*link != NULL);
+    link = &(*link)->next;
+  }
+  *link = entry->next;
+}
+
+void
+XIO_Response_Cache::remove (Entry* entry)
+{
+  assert (entry->response != NULL);
+  this->unlink (entry);
+  this->bytes_ -= entry->response->length ();
+  entry->response->release ();
+
+  Entry* last = this->clock_.back ();
+  this->clock_[entry->slot] = last;
+  last->slot = entry->slot;
+  this->clock_.pop_back ();
+  delete entry;
+}
+
+void
+XIO_Response_Cache::evict ()
+{
+  while (!this->clock_.empty () &&
+         (this->clock_.size () > this->max_entries_ || this->bytes_ > this->max_bytes_))
+  {
+    if (this->hand_ >= this->clock_.size ())
+    {
+      this->hand_ = 0;
+    }
+
+    // Referenced entries get a second chance
+    Entry* entry = this->clock_[this->hand_];
+    if (entry->referenced)
+    {
+      entry->referenced = false;
+      ++this->hand_;
+      continue;
+    }
+
+    // The last entry moves to the hand, which stays
+    this->remove (entry);
+    ++this->stats_.evictions;
+  }
+}
+
+int
+XIO_Response_Cache::send (const Request& req, Entry* entry)
+{
+  Cached_Response* rsp;
+  if (this->free_responses_.empty ())
+  {
+    rsp = new Cached_Response;
+  }
+  else
+  {
+    rsp = this->free_responses_.back ();
+    this->free_responses_.pop_back ();
+  }
+
+  XIO_Shared_Buffer* buffer = entry->response;
+  char* data = reinterpret_cast <char*> (buffer->data ());
+  xio_msg* msg = &rsp->msg;
+  memset (msg, 0, sizeof (xio_msg));
+  msg->request = req.msg;
+  // Tags the message as ours, see complete ()
+  msg->user_context = this;
+  msg->out.header.iov_base = entry->header_len > 0 ? data : NULL;
+  msg->out.header.iov_len = entry->header_len;
+  if (buffer->length () > entry->header_len)
+  {
+    msg->out.data_iovlen = 1;
+    msg->out.data_iov[0].iov_base = data + entry->header_len;
+    msg->out.data_iov[0].iov_len = buffer->length () - entry->header_len;
+    msg->out.data_iov[0].mr = buffer->mr ();
+  }
+  rsp->buffer = buffer->acquire ();
+
+  if (xio_send_response (msg) != 0)
+  {
+    buffer->release ();
+    this->free_responses_.push_back (rsp);
+    return -1;
+  }
+  return 0;
+}
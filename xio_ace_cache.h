@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XIO_ACE_CACHE_H
+#define XIO_ACE_CACHE_H
+
+#include "xio_ace_multicast.h"
+#include "xio_ace_session.h"
+
+#include <libxio.h>
+#include <ace/Time_Value.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * A cache of responses to idempotent requests.
+ *
+ * Requests are keyed by their header and data bytes. A response sent
+ * with XIO_Server::send_response is copied once into a shared buffer,
+ * every later identical request is answered with that buffer without
+ * reaching on_msg. Identical requests arriving while the first one is
+ * computed are collapsed onto it and answered with its response.
+ * Entries expire after a TTL and are evicted by CLOCK (second chance)
+ * once the entry or byte bound is reached.
+ *
+ * Attach the cache to a server with XIO_Server::response_cache, which
+ * forwards its callbacks to it. Only the requests the server declares
+ * cacheable (XIO_Server::cacheable) are looked up, their responses
+ * must depend on the request alone. The cache is not thread safe, it is
+ * meant to be used by the thread running the server's context.
+ */
+class XIO_Response_Cache : public XIO_Server_Cache
+{
+public:
+  /// Counters since the cache was created
+  struct Stats
+  {
+    size_t hits;
+    size_t misses;
+    size_t collapsed;
+    size_t evictions;
+    size_t expirations;
+  };
+
+  /**
+   * Create an empty cache
+   *
+   * @param max_entries Maximal number of cached responses
+   * @param max_bytes Maximal number of bytes of cached responses
+   * @param ttl Time a response stays valid, zero for no expiry
+   * @param max_request_size Larger requests are not cached
+   */
+  XIO_Response_Cache (size_t max_entries,
+                      size_t max_bytes,
+                      const ACE_Time_Value& ttl,
+                      size_t max_request_size = 4096);
+  virtual ~XIO_Response_Cache ();
+
+  /// XIO_Server_Cache
+  virtual Lookup lookup (xio_session* session, xio_msg* req);
+  virtual int store (xio_msg* rsp, std::vector <Request>& failed);
+  virtual bool abandon (xio_msg* req, Request& next);
+  virtual void purge (xio_session* session, std::vector <Request>& next);
+  virtual bool complete (xio_msg* msg);
+
+  /// Drop all cached responses (requests being computed are kept)
+  void clear ();
+
+  /// Number of cached responses
+  size_t size () const;
+  /// Number of bytes of cached responses
+  size_t bytes () const;
+  /// Accessor to the counters
+  const Stats& stats () const;
+
+private:
+  struct Entry
+  {
+    uint64_t hash;
+    /// Request header followed by the request data
+    std::string key;
+    size_t key_header_len;
+    /// The response, NULL while the request is computed
+    XIO_Shared_Buffer* response;
+    size_t header_len;
+    ACE_Time_Value expires;
+    /// CLOCK reference bit
+    bool referenced;
+    /// Index in the clock, while cached
+    size_t slot;
+    /// Next entry of the bucket
+    Entry* next;
+    /// The request being computed and the requests collapsed onto it
+    Request leader;
+    std::vector <Request> waiting;
+  };
+
+  /// A response sent from the cache, msg is the first member
+  struct Cached_Response
+  {
+    xio_msg msg;
+    XIO_Shared_Buffer* buffer;
+  };
+
+  typedef std::map <xio_msg*, Entry*> Pending;
+
+  static uint64_t hash (const xio_msg* req);
+  static bool matches (const Entry* entry, const xio_msg* req);
+
+  Entry* find (uint64_t hash, const xio_msg* req);
+  void unlink (Entry* entry);
+  /// Free a cached entry
+  void remove (Entry* entry);
+  /// Evict by CLOCK until the bounds hold
+  void evict ();
+  int send (const Request& req, Entry* entry);
+
+  size_t max_entries_;
+  size_t max_bytes_;
+  ACE_Time_Value ttl_;
+  size_t max_request_size_;
+  std::vector <Entry*> buckets_;
+  /// Cached entries in CLOCK order
+  std::vector <Entry*> clock_;
+  size_t hand_;
+  size_t bytes_;
+  Pending pending_;
+  std::vector <Cached_Response*> free_responses_;
+  Stats stats_;
+};
+
+#endif // XIO_ACE_CACHE_H
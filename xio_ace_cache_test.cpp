@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Response cache check.
+ *
+ * Link with xio_ace_mock.cpp instead of libxio. Two client sessions send
+ * requests to a caching XIO_Server over the mock transport. The server
+ * holds every request it is asked to compute until the check answers
+ * it, echoing the request header. The check verifies that hits and
+ * collapsed requests are answered by the cache, that a computation which
+ * is abandoned or whose session is torn down is handed to a collapsed
+ * request, and that entries expire.
+ *
+ * Usage: xio_ace_cache_test
+ */
+
+#include "xio_ace_cache.h"
+#include "xio_ace_mock.h"
+#include "xio_ace_session.h"
+
+#include <ace/OS_NS_unistd.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <list>
+
+static int failures = 0;
+
+static void check (bool ok, const char* what)
+{
+  printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok)
+  {
+    ++failures;
+  }
+}
+
+////////////////////////////////////////////////////////
+///  Server
+////////////////////////////////////////////////////////
+class Test_Server : public XIO_Server
+{
+public:
+  static const XIO_Callback_Implementor::Callback cbs =
+    (XIO_Callback_Implementor::Callback) (XIO_Callback_Implementor::XIO_CB_ON_MSG |
+                                          XIO_Callback_Implementor::XIO_CB_ON_MSG_SEND_COMPLETE |
+                                          XIO_Callback_Implementor::XIO_CB_ON_SESSION_EVENT);
+
+  Test_Server ()
+  : XIO_Server (cbs)
+  , computed (0)
+  {
+  }
+
+  virtual bool cacheable (xio_session* session, xio_msg* msg)
+  {
+    return true;
+  }
+
+  virtual int on_msg (xio_session* session, xio_msg* msg, int more_in_batch)
+  {
+    Held held = { session, msg };
+    this->held.push_back (held);
+    ++this->computed;
+    return 0;
+  }
+
+  virtual int on_msg_send_complete (xio_session* session, xio_msg* msg)
+  {
+    delete msg;
+    return 0;
+  }
+
+  virtual int on_session_event (xio_session* session, xio_session_event_data* data)
+  {
+    if (data->event == XIO_SESSION_TEARDOWN_EVENT)
+    {
+      for (std::deque <Held>::iterator it = this->held.begin (); it != this->held.end (); )
+      {
+        it = it->session == session ? this->held.erase (it) : it + 1;
+      }
+    }
+    return 0;
+  }
+
+  /// Answer the oldest held request, through the cache or around it
+  void answer (bool cached)
+  {
+    Held held = this->held.front ();
+    this->held.pop_front ();
+
+    xio_msg* rsp = new xio_msg;
+    memset (rsp, 0, sizeof (xio_msg));
+    rsp->request = held.msg;
+    rsp->out.header = held.msg->in.header;
+    if (cached)
+    {
+      this->send_response (held.session, rsp);
+    }
+    else
+    {
+      xio_send_response (rsp);
+    }
+  }
+
+  struct Held
+  {
+    xio_session* session;
+    xio_msg* msg;
+  };
+
+  std::deque <Held> held;
+  int computed;
+};
+
+////////////////////////////////////////////////////////
+///  Client
+////////////////////////////////////////////////////////
+class Test_Session : public XIO_Reqeust_Session
+{
+public:
+  Test_Session ()
+  : XIO_Reqeust_Session (XIO_Callback_Implementor::XIO_CB_ON_MSG)
+  {
+  }
+};
+
+class Test_Connection : public XIO_Connection
+{
+public:
+  Test_Connection ()
+  : received (0)
+  , mismatched (0)
+  {
+  }
+
+  /// Send a request whose header is the key
+  void send (const char* key)
+  {
+    this->reqs_.push_back (xio_msg ());
+    xio_msg* req = &this->reqs_.back ();
+    memset (req, 0, sizeof (xio_msg));
+    req->out.header.iov_base = const_cast <char*> (key);
+    req->out.header.iov_len = strlen (key);
+    this->send_request (req, true);
+  }
+
+  virtual int on_msg (xio_session* session, xio_msg* rsp, int more_in_batch)
+  {
+    const xio_iovec& sent = rsp->request->out.header;
+    if (rsp->in.header.iov_len != sent.iov_len ||
+        memcmp (rsp->in.header.iov_base, sent.iov_base, sent.iov_len) != 0)
+    {
+      ++this->mismatched;
+    }
+    ++this->received;
+    this->release_response (rsp);
+    return 0;
+  }
+
+  int received;
+  int mismatched;
+
+private:
+  /// Requests stay valid until the connection goes away
+  std::list <xio_msg> reqs_;
+};
+
+/// Deliver all queued events
+static void settle (ACE_Reactor* reactor, xio_context* ctx)
+{
+  while (xio_ace_mock_pending (ctx) > 0)
+  {
+    reactor->handle_events ();
+  }
+}
+
+int main (int argc, char* argv[])
+{
+  ACE_Reactor* reactor = ACE_Reactor::instance ();
+  xio_context* ctx = xio_ace_ctx_open (reactor, 0);
+  if (ctx == NULL)
+  {
+    printf("Failed to open context\n");
+    return -1;
+  }
+
+  const ACE_Time_Value ttl (0, 100000);
+  XIO_Response_Cache cache (16, 1 << 20, ttl);
+  Test_Server server;
+  server.response_cache (&cache);
+  server.open (ctx, "mock://cache", NULL, 0);
+
+  Test_Session session_a;
+  session_a.open ("mock://cache", 0, 0, NULL, 0);
+  Test_Connection a;
+  a.open (&session_a, ctx, 0);
+  Test_Session session_b;
+  session_b.open ("mock://cache", 0, 0, NULL, 0);
+  Test_Connection b;
+  b.open (&session_b, ctx, 0);
+  settle (reactor, ctx);
+
+  // A stored response answers the next identical request
+  a.send ("hit");
+  settle (reactor, ctx);
+  server.answer (true);
+  settle (reactor, ctx);
+  a.send ("hit");
+  settle (reactor, ctx);
+  check (server.computed == 1 && a.received == 2 && cache.stats ().hits == 1,
+         "hit answered from the cache");
+
+  // An identical request waits for the one being computed
+  a.send ("collapse");
+  b.send ("collapse");
+  settle (reactor, ctx);
+  check (server.held.size () == 1 && cache.stats ().collapsed == 1,
+         "collapsed request not computed");
+  server.answer (true);
+  settle (reactor, ctx);
+  check (a.received == 3 && b.received == 1, "collapsed request answered");
+
+  // A response sent around the cache hands the computation over
+  a.send ("abandon");
+  b.send ("abandon");
+  settle (reactor, ctx);
+  server.answer (false);
+  settle (reactor, ctx);
+  check (server.computed == 4 && server.held.size () == 1 && a.received == 4,
+         "abandoned computation handed over");
+  server.answer (true);
+  settle (reactor, ctx);
+  check (b.received == 2, "handed over request answered");
+
+  // A torn down session hands its computations over
+  a.send ("purge");
+  b.send ("purge");
+  settle (reactor, ctx);
+  a.close ();
+  session_a.close ();
+  settle (reactor, ctx);
+  check (server.computed == 6 && server.held.size () == 1,
+         "computation of a torn down session handed over");
+  server.answer (true);
+  settle (reactor, ctx);
+  check (b.received == 3, "handed over request answered");
+
+  // An expired response is computed again
+  b.send ("ttl");
+  settle (reactor, ctx);
+  server.answer (true);
+  settle (reactor, ctx);
+  ACE_OS::sleep (ttl + ttl);
+  b.send ("ttl");
+  settle (reactor, ctx);
+  check (server.computed == 8 && cache.stats ().expirations == 1,
+         "expired response computed again");
+  server.answer (true);
+  settle (reactor, ctx);
+  check (b.received == 5, "recomputed request answered");
+
+  check (a.mismatched == 0 && b.mismatched == 0, "responses match their requests");
+  check (server.load ().requests == 0, "no request outstanding");
+
+  b.close ();
+  session_b.close ();
+  settle (reactor, ctx);
+  server.close ();
+  xio_ctx_close (ctx);
+
+  printf("%s\n", failures == 0 ? "PASSED" : "FAILED");
+  return failures == 0 ? 0 : -1;
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "xio_ace_codec.h"
+#include "xio_ace_pool.h"
+
+#include <string.h>
+
+/// Marks codec messages ("XC")
+static const uint16_t CODEC_MAGIC = 0x5843;
+
+/// Fields and the data area are 8 bytes aligned
+static size_t align8 (size_t len)
+{
+  return (len + 7) & ~static_cast <size_t> (7);
+}
+
+////////////////////////////////////////////////////////
+///  XIO_Codec_Writer
+////////////////////////////////////////////////////////
+XIO_Codec_Writer::XIO_Codec_Writer ()
+: msg_ (NULL)
+, buffer_ (NULL)
+, size_ (0)
+, mr_ (NULL)
+, header_len_ (0)
+, data_offset_ (0)
+, data_len_ (0)
+{
+}
+
+void*
+XIO_Codec_Writer::start (xio_msg* msg, uint16_t type, size_t fixed_len,
+                         void* buffer, size_t size, struct xio_mr* mr)
+{
+  size_t header_len = sizeof (XIO_Codec_Envelope) + fixed_len;
+  if (buffer == NULL || header_len > size)
+  {
+    return NULL;
+  }
+
+  this->msg_ = msg;
+  this->buffer_ = reinterpret_cast <char*> (buffer);
+  this->size_ = size;
+  this->mr_ = mr;
+  this->header_len_ = header_len;
+  this->data_offset_ = align8 (header_len);
+  this->data_len_ = 0;
+
+  memset (this->buffer_, 0, header_len);
+  XIO_Codec_Envelope* envelope = reinterpret_cast <XIO_Codec_Envelope*> (this->buffer_);
+  envelope->magic = CODEC_MAGIC;
+  envelope->type = type;
+  envelope->fixed_len = static_cast <uint32_t> (fixed_len);
+  return envelope + 1;
+}
+
+void*
+XIO_Codec_Writer::start (xio_msg* msg, uint16_t type, size_t fixed_len, XIO_Buffer_Pool& pool)
+{
+  void* buffer = pool.get ();
+  if (buffer == NULL)
+  {
+    return NULL;
+  }
+
+  void* fixed = this->start (msg, type, fixed_len, buffer, pool.buffer_size (), pool.mr ());
+  if (fixed == NULL)
+  {
+    pool.put (buffer);
+  }
+  return fixed;
+}
+
+void*
+XIO_Codec_Writer::reserve (XIO_Codec_Field& field, size_t len)
+{
+  size_t offset = align8 (this->data_len_);
+  if (this->buffer_ == NULL ||
+      len > this->size_ ||
+      this->data_offset_ + offset > this->size_ - len)
+  {
+    return NULL;
+  }
+
+  field.offset = static_cast <uint32_t> (offset);
+  field.length = static_cast <uint32_t> (len);
+  this->data_len_ = offset + len;
+  return this->buffer_ + this->data_offset_ + offset;
+}
+
+int
+XIO_Codec_Writer::add (XIO_Codec_Field& field, const void* src, size_t len)
+{
+  void* dst = this->reserve (field, len);
+  if (dst == NULL)
+  {
+    return -1;
+  }
+  memcpy (dst, src, len);
+  return 0;
+}
+
+size_t
+XIO_Codec_Writer::finish ()
+{
+  if (this->msg_ == NULL)
+  {
+    return 0;
+  }
+
+  XIO_Codec_Envelope* envelope = reinterpret_cast <XIO_Codec_Envelope*> (this->buffer_);
+  envelope->data_len = static_cast <uint32_t> (this->data_len_);
+
+  xio_vmsg& out = this->msg_->out;
+  out.header.iov_base = this->buffer_;
+  out.header.iov_len = this->header_len_;
+  if (this->data_len_ > 0)
+  {
+    out.data_iovlen = 1;
+    out.data_iov[0].iov_base = this->buffer_ + this->data_offset_;
+    out.data_iov[0].iov_len = this->data_len_;
+    out.data_iov[0].mr = this->mr_;
+  }
+  else
+  {
+    out.data_iovlen = 0;
+  }
+
+  this->msg_ = NULL;
+  return this->header_len_ + this->data_len_;
+}
+
+void*
+XIO_Codec_Writer::buffer (xio_msg* msg)
+{
+  return msg->out.header.iov_base;
+}
+
+////////////////////////////////////////////////////////
+///  XIO_Codec_Reader
+////////////////////////////////////////////////////////
+XIO_Codec_Reader::XIO_Codec_Reader ()
+: envelope_ (NULL)
+, data_ (NULL)
+, data_len_ (0)
+{
+}
+
+int
+XIO_Codec_Reader::open (xio_msg* msg)
+{
+  this->envelope_ = NULL;
+  this->data_ = NULL;
+  this->data_len_ = 0;
+
+  const xio_vmsg& in = msg->in;
+  if (in.header.iov_base == NULL || in.header.iov_len < sizeof (XIO_Codec_Envelope))
+  {
+    return -1;
+  }
+
+  const XIO_Codec_Envelope* envelope = reinterpret_cast <const XIO_Codec_Envelope*> (in.header.iov_base);
+  if (envelope->magic != CODEC_MAGIC ||
+      envelope->fixed_len > in.header.iov_len - sizeof (XIO_Codec_Envelope))
+  {
+    return -1;
+  }
+
+  // The data area is read in place, it must arrive in one vector
+  if (envelope->data_len > 0)
+  {
+    if (in.data_iovlen != 1 ||
+        in.data_iov[0].iov_base == NULL ||
+        in.data_iov[0].iov_len < envelope->data_len)
+    {
+      return -1;
+    }
+    this->data_ = reinterpret_cast <const char*> (in.data_iov[0].iov_base);
+    this->data_len_ = envelope->data_len;
+  }
+
+  this->envelope_ = envelope;
+  return 0;
+}
+
+uint16_t
+XIO_Codec_Reader::type () const
+{
+  return this->envelope_ ? this->envelope_->type : 0;
+}
+
+const void*
+XIO_Codec_Reader::field (const XIO_Codec_Field& field) const
+{
+  if (field.offset > this->data_len_ ||
+      field.length > this->data_len_ - field.offset)
+  {
+    return NULL;
+  }
+  return this->data_ + field.offset;
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XIO_ACE_CODEC_H
+#define XIO_ACE_CODEC_H
+
+#include <libxio.h>
+
+#include <stdint.h>
+#include <vector>
+
+class XIO_Buffer_Pool;
+
+/**
+ * Typed messages read in place.
+ *
+ * A message type is a struct of fixed width members (no pointers, no
+ * virtuals) with a static TYPE_ID. Variable length members are
+ * XIO_Codec_Field offsets into a data area:
+ *
+ *   struct Get_Request
+ *   {
+ *     static const uint16_t TYPE_ID = 1;
+ *     uint64_t version;
+ *     XIO_Codec_Field key;
+ *   };
+ *
+ * The writer lays a message out in one (registered) buffer: an envelope
+ * and the struct go to the header vector, the variable fields follow in
+ * the data vector. The reader points into the received vectors: no
+ * parse step, no copy and no allocation. Both sides must share the byte
+ * order and the struct layouts; members may be appended to a struct,
+ * the reader accepts larger fixed parts than it knows of.
+ */
+
+/// A variable length field, relative to the data area
+struct XIO_Codec_Field
+{
+  uint32_t offset;
+  uint32_t length;
+};
+
+/// Precedes the fixed part in the header vector
+struct XIO_Codec_Envelope
+{
+  uint16_t magic;
+  uint16_t type;
+  /// Size of the fixed part
+  uint32_t fixed_len;
+  /// Size of the data area
+  uint32_t data_len;
+  uint32_t reserved;
+};
+
+/**
+ * Lays a message out in a buffer and points the out vectors of an
+ * xio_msg at it
+ */
+class XIO_Codec_Writer
+{
+public:
+  XIO_Codec_Writer ();
+
+  /**
+   * Start a message in a buffer
+   *
+   * @param msg The message, its out vectors are set by finish
+   * @param buffer The buffer, 8 bytes aligned
+   * @param size Size of the buffer
+   * @param mr Registration of the buffer, NULL to let the library copy
+   *
+   * @return The zeroed fixed part, NULL if the buffer is too small
+   */
+  template <class T>
+  T* begin (xio_msg* msg, void* buffer, size_t size, struct xio_mr* mr = NULL)
+  {
+    return reinterpret_cast <T*> (this->start (msg, T::TYPE_ID, sizeof (T), buffer, size, mr));
+  }
+
+  /**
+   * Start a message in a buffer of a pool. The buffer is the header
+   * base of the message (see buffer), put it back once sent
+   *
+   * @return The zeroed fixed part, NULL if the pool is exhausted or its
+   *         buffers are too small
+   */
+  template <class T>
+  T* begin (xio_msg* msg, XIO_Buffer_Pool& pool)
+  {
+    return reinterpret_cast <T*> (this->start (msg, T::TYPE_ID, sizeof (T), pool));
+  }
+
+  /**
+   * Reserve a variable field to be written in place
+   *
+   * @param field The field of the fixed part to point at it
+   * @param len Size of the field
+   *
+   * @return The field, NULL if the buffer is full
+   */
+  void* reserve (XIO_Codec_Field& field, size_t len);
+
+  /**
+   * Copy a variable field
+   *
+   * @return 0 on success, -1 if the buffer is full
+   */
+  int add (XIO_Codec_Field& field, const void* src, size_t len);
+
+  /**
+   * Set the out vectors of the message
+   *
+   * @return Number of bytes of the message
+   */
+  size_t finish ();
+
+  /// The buffer a message was written to
+  static void* buffer (xio_msg* msg);
+
+private:
+  void* start (xio_msg* msg, uint16_t type, size_t fixed_len,
+               void* buffer, size_t size, struct xio_mr* mr);
+  void* start (xio_msg* msg, uint16_t type, size_t fixed_len, XIO_Buffer_Pool& pool);
+
+  xio_msg* msg_;
+  char* buffer_;
+  size_t size_;
+  struct xio_mr* mr_;
+  /// Envelope and fixed part
+  size_t header_len_;
+  /// Start of the data area in the buffer
+  size_t data_offset_;
+  size_t data_len_;
+};
+
+/**
+ * Reads a received message in place, valid as long as the message is
+ */
+class XIO_Codec_Reader
+{
+public:
+  XIO_Codec_Reader ();
+
+  /**
+   * Check the envelope of the in vectors of a message
+   *
+   * @return 0 on success, -1 if the message is not a codec message or is
+   *         truncated
+   */
+  int open (xio_msg* msg);
+
+  /// Type id of the message
+  uint16_t type () const;
+
+  /// The fixed part, NULL if the message is of another type or too short
+  template <class T>
+  const T* get () const
+  {
+    if (this->envelope_ == NULL ||
+        this->envelope_->type != T::TYPE_ID ||
+        this->envelope_->fixed_len < sizeof (T))
+    {
+      return NULL;
+    }
+    return reinterpret_cast <const T*> (this->envelope_ + 1);
+  }
+
+  /// A variable field, NULL if it is out of the data area
+  const void* field (const XIO_Codec_Field& field) const;
+
+private:
+  const XIO_Codec_Envelope* envelope_;
+  const char* data_;
+  size_t data_len_;
+};
+
+/**
+ * Dispatches received messages to the member handling their type.
+ *
+ *   dispatcher.add <Get_Request, &My_Server::on_get> ();
+ *   ...
+ *   int My_Server::on_msg (xio_session* session, xio_msg* msg, int more_in_batch)
+ *   {
+ *     return this->dispatcher_.dispatch (this, session, msg);
+ *   }
+ *
+ * with int My_Server::on_get (xio_session*, xio_msg*, const Get_Request&,
+ * const XIO_Codec_Reader&). Type ids index a table, keep them small.
+ */
+template <class Target>
+class XIO_Codec_Dispatcher
+{
+public:
+  typedef int (*Thunk) (Target* target, xio_session* session, xio_msg* msg,
+                        const XIO_Codec_Reader& reader);
+
+  /// Route the messages of type T to a member
+  template <class T, int (Target::*Handler) (xio_session*, xio_msg*, const T&, const XIO_Codec_Reader&)>
+  void add ()
+  {
+    if (this->thunks_.size () <= T::TYPE_ID)
+    {
+      this->thunks_.resize (T::TYPE_ID + 1, (Thunk) NULL);
+    }
+    this->thunks_[T::TYPE_ID] = &XIO_Codec_Dispatcher::template call <T, Handler>;
+  }
+
+  /**
+   * Call the handler of a message
+   *
+   * @return The handler's result, -1 if the message is malformed or its
+   *         type has no handler
+   */
+  int dispatch (Target* target, xio_session* session, xio_msg* msg) const
+  {
+    XIO_Codec_Reader reader;
+    if (reader.open (msg) != 0 ||
+        reader.type () >= this->thunks_.size () ||
+        this->thunks_[reader.type ()] == NULL)
+    {
+      return -1;
+    }
+    return this->thunks_[reader.type ()] (target, session, msg, reader);
+  }
+
+private:
+  template <class T, int (Target::*Handler) (xio_session*, xio_msg*, const T&, const XIO_Codec_Reader&)>
+  static int call (Target* target, xio_session* session, xio_msg* msg,
+                   const XIO_Codec_Reader& reader)
+  {
+    const T* fixed = reader.get <T> ();
+    if (fixed == NULL)
+    {
+      return -1;
+    }
+    return (target->*Handler) (session, msg, *fixed, reader);
+  }
+
+  std::vector <Thunk> thunks_;
+};
+
+#endif // XIO_ACE_CODEC_H
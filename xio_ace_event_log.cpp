@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "xio_ace_event_log.h"
+#include "xio_ace_session.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+XIO_Event_Log* xio_ace_event_log = NULL;
+
+/// Total length of a vmsg's data
+static uint32_t data_length (const xio_vmsg& vmsg)
+{
+  size_t len = 0;
+  for (size_t i = 0; i < vmsg.data_iovlen; ++i)
+  {
+    len += vmsg.data_iov[i].iov_len;
+  }
+  return static_cast <uint32_t> (len);
+}
+
+/// The event hooks of the wrappers
+static void event_fill_hook (XIO_Event_Record& record, int type, xio_session* session,
+                             xio_msg* msg, int arg)
+{
+  xio_ace_event_fill (record, static_cast <XIO_Event_Type> (type), session, msg, arg);
+}
+
+void xio_ace_event_log_attach (XIO_Event_Log* log)
+{
+  __atomic_store_n (&xio_ace_event_log, log, __ATOMIC_RELEASE);
+  xio_ace_hooks.event_fill = log ? event_fill_hook : NULL;
+  xio_ace_hooks.event_append = log ? xio_ace_event_append : NULL;
+}
+
+void xio_ace_event_fill (XIO_Event_Record& record,
+                         XIO_Event_Type type,
+                         xio_session* session,
+                         xio_msg* msg,
+                         int arg)
+{
+  memset (&record, 0, sizeof (record));
+  record.session = reinterpret_cast <uintptr_t> (session);
+  record.type = type;
+  record.arg = arg;
+  if (msg)
+  {
+    // Received messages carry their payload in in, sent ones in out
+    bool received = type == XIO_EVENT_ON_MSG ||
+                    type == XIO_EVENT_DEFERRED_MSG ||
+                    type == XIO_EVENT_ASSIGN_DATA_IN_BUF;
+    const xio_vmsg& vmsg = received ? msg->in : msg->out;
+    record.sn = xio_ace_trace_sn (msg);
+    record.msg_type = msg->type;
+    record.header_len = static_cast <uint32_t> (vmsg.header.iov_len);
+    record.data_len = data_length (vmsg);
+  }
+  record.timestamp_ns = xio_ace_trace_now ();
+}
+
+void xio_ace_event_append (XIO_Event_Record& record)
+{
+  // The log may have been detached meanwhile
+  XIO_Event_Log* log = __atomic_load_n (&xio_ace_event_log, __ATOMIC_ACQUIRE);
+  if (log)
+  {
+    record.duration_ns = xio_ace_trace_now () - record.timestamp_ns;
+    log->append (record);
+  }
+}
+
+////////////////////////////////////////////////////////
+///  XIO_Event_Log
+////////////////////////////////////////////////////////
+XIO_Event_Log::XIO_Event_Log ()
+: fd_ (-1)
+, base_ (NULL)
+, capacity_ (0)
+, tail_ (0)
+, dropped_ (0)
+{
+}
+
+XIO_Event_Log::~XIO_Event_Log ()
+{
+  if (this->base_)
+  {
+    this->close ();
+  }
+}
+
+int
+XIO_Event_Log::open (const char* path, size_t capacity)
+{
+  if (this->base_ || capacity == 0)
+  {
+    return -1;
+  }
+
+  int fd = ::open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  // The file is sparse and zero filled, pages are allocated as written
+  size_t length = sizeof (XIO_Event_Log_Header) + capacity * sizeof (XIO_Event_Record);
+  if (ftruncate (fd, length) != 0)
+  {
+    ::close (fd);
+    return -1;
+  }
+  void* base = mmap (NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+  {
+    ::close (fd);
+    return -1;
+  }
+
+  XIO_Event_Log_Header* header = reinterpret_cast <XIO_Event_Log_Header*> (base);
+  memcpy (header->magic, "XIOEVLOG", sizeof (header->magic));
+  header->version = 1;
+  header->record_size = sizeof (XIO_Event_Record);
+  header->count = 0;
+
+  this->fd_ = fd;
+  this->base_ = reinterpret_cast <char*> (base);
+  this->capacity_ = capacity;
+  this->tail_ = 0;
+  this->dropped_ = 0;
+  return 0;
+}
+
+int
+XIO_Event_Log::close ()
+{
+  if (this->base_ == NULL)
+  {
+    return 0;
+  }
+
+  size_t count = this->size ();
+  reinterpret_cast <XIO_Event_Log_Header*> (this->base_)->count = count;
+
+  size_t length = sizeof (XIO_Event_Log_Header) + this->capacity_ * sizeof (XIO_Event_Record);
+  int retval = msync (this->base_, length, MS_SYNC);
+  munmap (this->base_, length);
+  if (ftruncate (this->fd_, sizeof (XIO_Event_Log_Header) + count * sizeof (XIO_Event_Record)) != 0)
+  {
+    retval = -1;
+  }
+  if (::close (this->fd_) != 0)
+  {
+    retval = -1;
+  }
+
+  this->fd_ = -1;
+  this->base_ = NULL;
+  this->capacity_ = 0;
+  return retval;
+}
+
+void
+XIO_Event_Log::append (const XIO_Event_Record& record)
+{
+  size_t idx = __atomic_fetch_add (&this->tail_, 1, __ATOMIC_RELAXED);
+  if (idx >= this->capacity_)
+  {
+    __atomic_fetch_add (&this->dropped_, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  XIO_Event_Record* records = reinterpret_cast <XIO_Event_Record*> (this->base_ + sizeof (XIO_Event_Log_Header));
+  records[idx] = record;
+}
+
+size_t
+XIO_Event_Log::size () const
+{
+  size_t tail = __atomic_load_n (&this->tail_, __ATOMIC_RELAXED);
+  return tail < this->capacity_ ? tail : this->capacity_;
+}
+
+size_t
+XIO_Event_Log::dropped () const
+{
+  return __atomic_load_n (&this->dropped_, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XIO_ACE_EVENT_LOG_H
+#define XIO_ACE_EVENT_LOG_H
+
+#include "xio_ace_trace.h"
+
+#include <libxio.h>
+
+/**
+ * Event recording.
+ *
+ * While a log is attached, the wrappers append every loop registration,
+ * fd event and callback to it: when it started, how long the handler
+ * took, the session, the serial number and the sizes of the message.
+ * The log is a memory mapped file of fixed capacity, appending costs an
+ * atomic add and a 48 byte copy. Recorded logs are replayed with
+ * XIO_Event_Replay.
+ */
+
+/// The recorded events
+enum XIO_Event_Type
+{
+  /// A handler was registered by accelio (arg: fd, sn: XIO_POLL* events)
+  XIO_EVENT_LOOP_ADD = 1,
+  /// A handler was removed by accelio (arg: fd)
+  XIO_EVENT_LOOP_REMOVE,
+  /// The reactor called an accelio handler (arg: fd)
+  XIO_EVENT_FD,
+  XIO_EVENT_ASSIGN_DATA_IN_BUF,
+  /// arg: more_in_batch
+  XIO_EVENT_ON_MSG,
+  /// arg: more_in_batch
+  XIO_EVENT_ON_MSG_DELIVERED,
+  /// arg: xio_status
+  XIO_EVENT_ON_MSG_ERROR,
+  XIO_EVENT_ON_MSG_SEND_COMPLETE,
+  XIO_EVENT_ON_NEW_SESSION,
+  XIO_EVENT_ON_SESSION_ESTABLISHED,
+  /// arg: xio_session_event
+  XIO_EVENT_ON_SESSION_EVENT,
+  /// A server called on_msg with a deferred request (arg: more_in_batch),
+  /// the ON_MSG event that queued it did not call on_msg
+  XIO_EVENT_DEFERRED_MSG
+};
+
+/// An event, as stored in the log file
+struct XIO_Event_Record
+{
+  /// CLOCK_MONOTONIC time the event started in nanoseconds
+  uint64_t timestamp_ns;
+  /// Time spent in the handler in nanoseconds
+  uint64_t duration_ns;
+  /// Session of the event (address in the recording process)
+  uint64_t session;
+  /// Serial number of the request the message belongs to
+  uint64_t sn;
+  /// XIO_Event_Type
+  uint16_t type;
+  /// xio_msg_type of the message
+  uint16_t msg_type;
+  /// Depends on the type
+  int32_t arg;
+  /// Header length of the message
+  uint32_t header_len;
+  /// Total data length of the message
+  uint32_t data_len;
+};
+
+/**
+ * Start of the log file, the records follow.
+ * The count is written by close, a log that was not closed (a crashed
+ * process) has a zero count, its records end at the first zero
+ * timestamp.
+ */
+struct XIO_Event_Log_Header
+{
+  /// "XIOEVLOG"
+  char magic[8];
+  /// Format version (1)
+  uint32_t version;
+  /// sizeof (XIO_Event_Record)
+  uint32_t record_size;
+  /// Number of records
+  uint64_t count;
+};
+
+/// An append only event log in a memory mapped file
+class XIO_Event_Log
+{
+public:
+  XIO_Event_Log ();
+  virtual ~XIO_Event_Log ();
+
+  /**
+   * Create a log file
+   *
+   * @param path The file to create
+   * @param capacity Maximal number of records, later events are dropped
+   *
+   * @return 0 on success, -1 upon error
+   */
+  int open (const char* path, size_t capacity);
+
+  /**
+   * Write the record count, trim and close the file
+   *
+   * @note Detach the log and stop the reactors first
+   */
+  int close ();
+
+  /// Append a record, thread safe
+  void append (const XIO_Event_Record& record);
+
+  /// Number of records appended
+  size_t size () const;
+  /// Number of records dropped because the log was full
+  size_t dropped () const;
+
+private:
+  int fd_;
+  char* base_;
+  size_t capacity_;
+  size_t tail_;
+  size_t dropped_;
+};
+
+/// The log events are recorded to, NULL (the default) disables recording
+extern XIO_Event_Log* xio_ace_event_log;
+
+/**
+ * Attach a log (NULL detaches)
+ *
+ * @note Attach before the contexts are opened to record the loop
+ *       registrations
+ */
+void xio_ace_event_log_attach (XIO_Event_Log* log);
+
+/**
+ * Fill a record at the start of an event, the event_fill hook of the
+ * wrappers while a log is attached. The message is read now, the
+ * handler may free it.
+ *
+ * @param record Filled with the event
+ * @param type The event
+ * @param session The session, can be NULL
+ * @param msg The message, can be NULL
+ * @param arg Depends on the type
+ */
+void xio_ace_event_fill (XIO_Event_Record& record,
+                         XIO_Event_Type type,
+                         xio_session* session,
+                         xio_msg* msg,
+                         int arg);
+
+/// Append a record at the end of an event, the event_append hook
+void xio_ace_event_append (XIO_Event_Record& record);
+
+#endif // XIO_ACE_EVENT_LOG_H
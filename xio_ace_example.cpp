@@ -158,10 +158,10 @@ public:
   virtual int on_msg(xio_session* session, xio_msg* msg, int more_in_batch)
   {
     printf("Example_Connection::%s called\n", __FUNCTION__);
-    xio_release_response (msg);
+    this->release_response (msg);
     if (--num_messages_ == 0)
     {
-      xio_disconnect (this->connection ());
+      this->disconnect ();
     }
     return 0;
   }
@@ -200,6 +200,9 @@ int main (int argc, char* argv[])
     snprintf (listen_uri, 256, "rdma://0.0.0.0:%s", argv[1]);
 
     Example_Server server;
+    // Unlimited sessions, shed requests beyond 128 per session / 1024 total
+    XIO_Server::Limits limits = { 0, 128, 1024 };
+    server.limits (limits);
     server.open (ctx, listen_uri, NULL, 0);
 
     reactor->restart (1);
@@ -214,6 +217,8 @@ int main (int argc, char* argv[])
     snprintf (connect_uri, 256, "rdma://%s:%s", argv[1], argv[2]);
 
     Example_Session session (reactor);
+    // Reconnect after 10ms, backing off up to 1s, give up after 10 attempts
+    session.enable_reconnect (reactor, ACE_Time_Value (0, 10000), ACE_Time_Value (1), 10);
     if (session.open (connect_uri, 0, 0, NULL, 0) == NULL)
     {
       printf("Failed to open session\n");
@@ -233,7 +238,7 @@ int main (int argc, char* argv[])
     memset (&req_msgs[0], 0, sizeof(req_msgs));
     for (int i = 0; i < NUM_MSG; ++i)
     {
-      xio_send_request (conn.connection (), &req_msgs[i]);
+      conn.send_request (&req_msgs[i], true);
     }
 
     reactor->restart (1);
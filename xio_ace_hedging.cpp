@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "xio_ace_hedging.h"
+
+#include <ace/OS_NS_sys_time.h>
+
+#include <algorithm>
+#include <assert.h>
+
+////////////////////////////////////////////////////////
+///  XIO_Hedging_Client
+////////////////////////////////////////////////////////
+XIO_Hedging_Client::XIO_Hedging_Client (ACE_Reactor* reactor,
+                                        double percentile,
+                                        const ACE_Time_Value& min_delay,
+                                        double max_hedge_percent)
+: reactor_ (reactor)
+, percentile_ (percentile)
+, min_delay_ (min_delay)
+, delay_ (min_delay)
+, max_hedge_percent_ (max_hedge_percent)
+, next_conn_ (0)
+, latencies_usec_ (LATENCY_WINDOW, 0)
+, latency_pos_ (0)
+, samples_ (0)
+, requests_ (0)
+, hedges_ (0)
+, hedge_wins_ (0)
+{
+}
+
+XIO_Hedging_Client::~XIO_Hedging_Client ()
+{
+  this->reactor_->cancel_timer (this);
+  for (std::set <Request*>::iterator it = this->outstanding_.begin ();
+       it != this->outstanding_.end ();
+       ++it)
+  {
+    delete *it;
+  }
+}
+
+void
+XIO_Hedging_Client::add_connection (XIO_Connection* conn)
+{
+  this->connections_.push_back (conn);
+}
+
+void
+XIO_Hedging_Client::remove_connection (XIO_Connection* conn)
+{
+  std::vector <XIO_Connection*>::iterator it =
+    std::find (this->connections_.begin (), this->connections_.end (), conn);
+  if (it != this->connections_.end ())
+  {
+    this->connections_.erase (it);
+  }
+}
+
+int
+XIO_Hedging_Client::send_request (const struct xio_vmsg& out, void* request_context)
+{
+  Request* req = new Request;
+  req->context = request_context;
+  req->out = out;
+  req->start = ACE_OS::gettimeofday ();
+  req->timer_id = -1;
+  req->done = false;
+  req->sent = 0;
+  req->pending = 0;
+
+  if (this->send_attempt (req, NULL, false) != 0)
+  {
+    delete req;
+    return -1;
+  }
+  ++this->requests_;
+  this->outstanding_.insert (req);
+
+  // Nothing to hedge to with a single connection
+  if (this->connections_.size () > 1)
+  {
+    req->timer_id = this->reactor_->schedule_timer (this, req, this->delay_);
+  }
+  return 0;
+}
+
+bool
+XIO_Hedging_Client::on_msg (xio_msg* rsp)
+{
+  if (rsp->request == NULL || rsp->request->user_context != this)
+  {
+    return false;
+  }
+
+  // msg is the first member of Attempt
+  Attempt* attempt = reinterpret_cast <Attempt*> (rsp->request);
+  Request* req = attempt->request;
+  this->sample_latency (ACE_OS::gettimeofday () - attempt->sent_at);
+
+  if (!req->done)
+  {
+    if (attempt->hedge)
+    {
+      ++this->hedge_wins_;
+    }
+    req->done = true;
+    if (req->timer_id != -1)
+    {
+      this->reactor_->cancel_timer (req->timer_id);
+      req->timer_id = -1;
+    }
+    this->on_response (req->context, rsp);
+  }
+
+  attempt->conn->release_response (rsp);
+  this->attempt_finished (req);
+  return true;
+}
+
+bool
+XIO_Hedging_Client::on_msg_error (xio_msg* msg)
+{
+  if (msg->user_context != this)
+  {
+    return false;
+  }
+
+  Attempt* attempt = reinterpret_cast <Attempt*> (msg);
+  Request* req = attempt->request;
+
+  if (!req->done && req->pending == 1)
+  {
+    // The last attempt failed - retry elsewhere if allowed
+    if (req->sent >= MAX_ATTEMPTS ||
+        this->send_attempt (req, attempt->conn, false) != 0)
+    {
+      this->finish (req);
+      this->on_request_failed (req->context);
+    }
+  }
+
+  this->attempt_finished (req);
+  return true;
+}
+
+void
+XIO_Hedging_Client::on_request_failed (void* request_context)
+{
+}
+
+size_t
+XIO_Hedging_Client::requests () const
+{
+  return this->requests_;
+}
+
+size_t
+XIO_Hedging_Client::hedges () const
+{
+  return this->hedges_;
+}
+
+size_t
+XIO_Hedging_Client::hedge_wins () const
+{
+  return this->hedge_wins_;
+}
+
+double
+XIO_Hedging_Client::hedge_rate () const
+{
+  if (this->requests_ == 0)
+  {
+    return 0.0;
+  }
+  return static_cast <double> (this->hedges_) / this->requests_;
+}
+
+ACE_Time_Value
+XIO_Hedging_Client::hedge_delay () const
+{
+  return this->delay_;
+}
+
+int
+XIO_Hedging_Client::handle_timeout (const ACE_Time_Value& current_time, const void* act)
+{
+  Request* req = reinterpret_cast <Request*> (const_cast <void*> (act));
+  req->timer_id = -1;
+
+  if (req->done || req->sent >= MAX_ATTEMPTS)
+  {
+    return 0;
+  }
+
+  // Do not let hedges amplify load beyond the budget
+  if (this->hedges_ * 100.0 >= this->max_hedge_percent_ * this->requests_)
+  {
+    return 0;
+  }
+
+  if (this->send_attempt (req, req->attempts[0].conn, true) == 0)
+  {
+    ++this->hedges_;
+  }
+  return 0;
+}
+
+int
+XIO_Hedging_Client::send_attempt (Request* req, XIO_Connection* exclude, bool hedge)
+{
+  assert (req->sent < MAX_ATTEMPTS);
+
+  size_t num_conns = this->connections_.size ();
+  for (size_t i = 0; i < num_conns; ++i)
+  {
+    size_t idx = (this->next_conn_ + i) % num_conns;
+    XIO_Connection* conn = this->connections_[idx];
+    if (conn == exclude || conn->connection () == NULL)
+    {
+      continue;
+    }
+
+    Attempt* attempt = &req->attempts[req->sent];
+    memset (&attempt->msg, 0, sizeof (xio_msg));
+    attempt->msg.out = req->out;
+    // Tags the message as ours, see on_msg ()
+    attempt->msg.user_context = this;
+    attempt->request = req;
+    attempt->conn = conn;
+    attempt->sent_at = ACE_OS::gettimeofday ();
+    attempt->hedge = hedge;
+
+    // Every attempt may be answered, so may a replay after a reconnect
+    if (conn->send_request (&attempt->msg, true) != 0)
+    {
+      continue;
+    }
+
+    ++req->sent;
+    ++req->pending;
+    this->next_conn_ = (idx + 1) % num_conns;
+    return 0;
+  }
+  return -1;
+}
+
+void
+XIO_Hedging_Client::finish (Request* req)
+{
+  req->done = true;
+  if (req->timer_id != -1)
+  {
+    this->reactor_->cancel_timer (req->timer_id);
+    req->timer_id = -1;
+  }
+}
+
+void
+XIO_Hedging_Client::attempt_finished (Request* req)
+{
+  assert (req->pending > 0);
+  if (--req->pending == 0 && req->done)
+  {
+    this->outstanding_.erase (req);
+    delete req;
+  }
+}
+
+void
+XIO_Hedging_Client::sample_latency (const ACE_Time_Value& latency)
+{
+  unsigned long long usec;
+  latency.to_usec (usec);
+  this->latencies_usec_[this->latency_pos_] = static_cast <unsigned long> (usec);
+  this->latency_pos_ = (this->latency_pos_ + 1) % LATENCY_WINDOW;
+  ++this->samples_;
+
+  // Recomputing is O(window), do it once every MIN_SAMPLES samples
+  if (this->samples_ < MIN_SAMPLES || this->samples_ % MIN_SAMPLES != 0)
+  {
+    return;
+  }
+
+  size_t count = std::min (this->samples_, static_cast <size_t> (LATENCY_WINDOW));
+  std::vector <unsigned long> sorted (this->latencies_usec_.begin (),
+                                      this->latencies_usec_.begin () + count);
+  size_t nth = static_cast <size_t> (this->percentile_ / 100.0 * (count - 1));
+  std::nth_element (sorted.begin (), sorted.begin () + nth, sorted.end ());
+
+  ACE_Time_Value delay (sorted[nth] / 1000000, sorted[nth] % 1000000);
+  this->delay_ = std::max (delay, this->min_delay_);
+}
+
+
+////////////////////////////////////////////////////////
+///  XIO_Hedged_Connection
+////////////////////////////////////////////////////////
+XIO_Hedged_Connection::XIO_Hedged_Connection (XIO_Hedging_Client* client)
+: client_ (client)
+{
+}
+
+int
+XIO_Hedged_Connection::on_msg (xio_session* session, xio_msg* msg, int more_in_batch)
+{
+  this->client_->on_msg (msg);
+  return 0;
+}
+
+int
+XIO_Hedged_Connection::on_msg_error (xio_session* session, xio_status error, xio_msg* msg)
+{
+  this->client_->on_msg_error (msg);
+  return 0;
+}
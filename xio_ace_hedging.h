@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XIO_ACE_HEDGING_H
+#define XIO_ACE_HEDGING_H
+
+#include "xio_ace_session.h"
+
+#include <ace/Event_Handler.h>
+#include <ace/Time_Value.h>
+
+#include <set>
+#include <vector>
+
+/**
+ * Client side request hedging.
+ *
+ * Requests are sent on one of the added connections. If no response
+ * arrived within a delay derived from the observed latency percentile
+ * the request is sent again on another connection (which may belong to
+ * another session/server). The first response is delivered by
+ * on_response, the response of the loser is released when it arrives.
+ *
+ * The client must be used from the thread running the reactor of the
+ * connections' context. Connections forward their on_msg and
+ * on_msg_error callbacks to the client, see XIO_Hedged_Connection.
+ * Attempts are sent as idempotent requests with
+ * XIO_Connection::send_request, they are replayed when their connection
+ * is reconnected.
+ * Close the connections before destroying the client, outstanding
+ * requests are freed with it.
+ */
+class XIO_Hedging_Client : public ACE_Event_Handler
+{
+public:
+  /**
+   * Create a hedging client
+   *
+   * @param reactor The reactor running the connections' context
+   * @param percentile Latency percentile (0-100) after which a request
+   *                   is hedged
+   * @param min_delay Lower bound of the hedging delay, also used until
+   *                  enough latencies were sampled
+   * @param max_hedge_percent Upper bound on the percentage of requests
+   *                          that may be hedged (protects the servers
+   *                          when everything is slow)
+   */
+  XIO_Hedging_Client (ACE_Reactor* reactor,
+                      double percentile,
+                      const ACE_Time_Value& min_delay,
+                      double max_hedge_percent);
+  virtual ~XIO_Hedging_Client ();
+
+  /// Add a connection requests can be sent on
+  void add_connection (XIO_Connection* conn);
+  /// Remove a connection (e.g. when it is closed)
+  void remove_connection (XIO_Connection* conn);
+
+  /**
+   * Send a request
+   *
+   * @param out The outgoing message, its buffers must stay valid until
+   *            on_response or on_request_failed is called
+   * @param request_context Passed back with the response
+   *
+   * @return 0 on success, -1 if no connection could send the request
+   */
+  int send_request (const struct xio_vmsg& out, void* request_context);
+
+  /**
+   * Handle a response
+   *
+   * @return true if the response belonged to the client (and was
+   *         released), false if it should be handled by the caller
+   */
+  bool on_msg (xio_msg* rsp);
+
+  /**
+   * Handle a send error
+   *
+   * @return true if the message belonged to the client, false if it
+   *         should be handled by the caller
+   */
+  bool on_msg_error (xio_msg* msg);
+
+  /// Callbacks
+  /// The first response of a request, released after the call returns
+  virtual void on_response (void* request_context, xio_msg* rsp) = 0;
+  /// All attempts of a request failed
+  virtual void on_request_failed (void* request_context);
+
+  /// Number of requests sent
+  size_t requests () const;
+  /// Number of requests that were hedged
+  size_t hedges () const;
+  /// Number of hedged requests where the hedge answered first
+  size_t hedge_wins () const;
+  /// Fraction of requests that were hedged
+  double hedge_rate () const;
+  /// The current hedging delay
+  ACE_Time_Value hedge_delay () const;
+
+  /// Fires the hedge of a slow request
+  virtual int handle_timeout (const ACE_Time_Value& current_time, const void* act);
+
+private:
+  enum { MAX_ATTEMPTS = 2, LATENCY_WINDOW = 1024, MIN_SAMPLES = 64 };
+
+  struct Request;
+
+  /// A single send of a request, msg must stay the first member
+  struct Attempt
+  {
+    xio_msg msg;
+    Request* request;
+    XIO_Connection* conn;
+    ACE_Time_Value sent_at;
+    /// Sent by the hedging timer (not a retry after an error)
+    bool hedge;
+  };
+
+  struct Request
+  {
+    void* context;
+    struct xio_vmsg out;
+    ACE_Time_Value start;
+    long timer_id;
+    bool done;
+    int sent;
+    int pending;
+    Attempt attempts[MAX_ATTEMPTS];
+  };
+
+  /// Send an attempt on the next usable connection other than exclude
+  int send_attempt (Request* req, XIO_Connection* exclude, bool hedge);
+  /// Complete a request that still waits for its result
+  void finish (Request* req);
+  /// Account for a finished attempt and free the request when possible
+  void attempt_finished (Request* req);
+  /// Add a latency sample and recompute the delay periodically
+  void sample_latency (const ACE_Time_Value& latency);
+
+  ACE_Reactor* reactor_;
+  double percentile_;
+  ACE_Time_Value min_delay_;
+  ACE_Time_Value delay_;
+  double max_hedge_percent_;
+  std::vector <XIO_Connection*> connections_;
+  size_t next_conn_;
+  /// Requests not freed yet
+  std::set <Request*> outstanding_;
+
+  std::vector <unsigned long> latencies_usec_;
+  size_t latency_pos_;
+  size_t samples_;
+
+  size_t requests_;
+  size_t hedges_;
+  size_t hedge_wins_;
+};
+
+
+/**
+ * A connection that forwards responses to a hedging client
+ */
+class XIO_Hedged_Connection : public XIO_Connection
+{
+public:
+  XIO_Hedged_Connection (XIO_Hedging_Client* client);
+
+  virtual int on_msg (xio_session* session, xio_msg* msg, int more_in_batch);
+  virtual int on_msg_error (xio_session* session, xio_status error, xio_msg* msg);
+
+private:
+  XIO_Hedging_Client* client_;
+};
+
+#endif // XIO_ACE_HEDGING_H
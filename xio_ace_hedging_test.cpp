@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Hedging check.
+ *
+ * Link with xio_ace_mock.cpp instead of libxio. An XIO_Hedging_Client
+ * sends requests over the mock transport to a slow server, which holds
+ * them until the check answers them, and to a fast server, which
+ * answers at once. The check verifies that a request held by the slow
+ * server is hedged to the fast one, that the response of the loser is
+ * released without being delivered and that a request whose
+ * connection is disconnected is retried on the other connection.
+ *
+ * Usage: xio_ace_hedging_test
+ */
+
+#include "xio_ace_mock.h"
+#include "xio_ace_session.h"
+#include "xio_ace_hedging.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+
+static int failures = 0;
+
+static void check (bool ok, const char* what)
+{
+  printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok)
+  {
+    ++failures;
+  }
+}
+
+////////////////////////////////////////////////////////
+///  Server
+////////////////////////////////////////////////////////
+class Test_Server : public XIO_Server
+{
+public:
+  static const XIO_Callback_Implementor::Callback cbs =
+    (XIO_Callback_Implementor::Callback) (XIO_Callback_Implementor::XIO_CB_ON_MSG |
+                                          XIO_Callback_Implementor::XIO_CB_ON_MSG_SEND_COMPLETE |
+                                          XIO_Callback_Implementor::XIO_CB_ON_SESSION_EVENT);
+
+  Test_Server (bool echo)
+  : XIO_Server (cbs)
+  , echo (echo)
+  , received (0)
+  {
+  }
+
+  /// Hold the request, or answer it at once when echoing
+  virtual int on_msg (xio_session* session, xio_msg* msg, int more_in_batch)
+  {
+    ++this->received;
+    Held held = { session, msg };
+    this->held.push_back (held);
+    if (this->echo)
+    {
+      this->answer ();
+    }
+    return 0;
+  }
+
+  virtual int on_msg_send_complete (xio_session* session, xio_msg* msg)
+  {
+    delete msg;
+    return 0;
+  }
+
+  virtual int on_session_event (xio_session* session, xio_session_event_data* data)
+  {
+    if (data->event == XIO_SESSION_TEARDOWN_EVENT)
+    {
+      for (std::deque <Held>::iterator it = this->held.begin (); it != this->held.end (); )
+      {
+        it = it->session == session ? this->held.erase (it) : it + 1;
+      }
+    }
+    return 0;
+  }
+
+  /// Answer the held requests, echoing their header
+  void answer ()
+  {
+    while (!this->held.empty ())
+    {
+      Held held = this->held.front ();
+      this->held.pop_front ();
+
+      xio_msg* rsp = new xio_msg;
+      memset (rsp, 0, sizeof (xio_msg));
+      rsp->request = held.msg;
+      rsp->out.header = held.msg->in.header;
+      xio_send_response (rsp);
+    }
+  }
+
+  struct Held
+  {
+    xio_session* session;
+    xio_msg* msg;
+  };
+
+  bool echo;
+  int received;
+  std::deque <Held> held;
+};
+
+////////////////////////////////////////////////////////
+///  Client
+////////////////////////////////////////////////////////
+class Test_Session : public XIO_Reqeust_Session
+{
+public:
+  static const XIO_Callback_Implementor::Callback cbs =
+    (XIO_Callback_Implementor::Callback) (XIO_Callback_Implementor::XIO_CB_ON_MSG |
+                                          XIO_Callback_Implementor::XIO_CB_ON_MSG_ERROR |
+                                          XIO_Callback_Implementor::XIO_CB_ON_SESSION_EVENT);
+
+  Test_Session ()
+  : XIO_Reqeust_Session (cbs)
+  {
+  }
+
+  virtual int on_session_event (xio_session* session, xio_session_event_data* data)
+  {
+    switch (data->event)
+    {
+    case XIO_SESSION_CONNECTION_CLOSED_EVENT:
+      {
+        XIO_Connection* connection = reinterpret_cast <XIO_Connection*> (data->conn_user_context);
+        if (connection)
+        {
+          connection->close ();
+        }
+      }
+      break;
+    case XIO_SESSION_TEARDOWN_EVENT:
+      this->close ();
+      break;
+    default:
+      break;
+    }
+    return 0;
+  }
+};
+
+class Test_Client : public XIO_Hedging_Client
+{
+public:
+  Test_Client (ACE_Reactor* reactor, const ACE_Time_Value& min_delay)
+  : XIO_Hedging_Client (reactor, 50, min_delay, 100)
+  , responses (0)
+  , failed (0)
+  , last (NULL)
+  {
+  }
+
+  virtual void on_response (void* request_context, xio_msg* rsp)
+  {
+    ++this->responses;
+    this->last = request_context;
+  }
+
+  virtual void on_request_failed (void* request_context)
+  {
+    ++this->failed;
+  }
+
+  int responses;
+  int failed;
+  /// Context of the last answered request
+  void* last;
+};
+
+/// Deliver all queued events
+static void settle (ACE_Reactor* reactor, xio_context* ctx)
+{
+  while (xio_ace_mock_pending (ctx) > 0)
+  {
+    reactor->handle_events ();
+  }
+}
+
+/// Handle events and timers for a while
+static void run (ACE_Reactor* reactor, const ACE_Time_Value& duration)
+{
+  ACE_Time_Value wait = duration;
+  reactor->handle_events (&wait);
+}
+
+int main (int argc, char* argv[])
+{
+  ACE_Reactor* reactor = ACE_Reactor::instance ();
+  xio_context* ctx = xio_ace_ctx_open (reactor, 0);
+  if (ctx == NULL)
+  {
+    printf("Failed to open context\n");
+    return -1;
+  }
+
+  Test_Server slow_server (false);
+  slow_server.open (ctx, "mock://slow", NULL, 0);
+  Test_Server fast_server (true);
+  fast_server.open (ctx, "mock://fast", NULL, 0);
+
+  const ACE_Time_Value min_delay (0, 5000);
+  Test_Client client (reactor, min_delay);
+
+  // Reconnect keeps a replay log, released attempts must leave it
+  const ACE_Time_Value backoff (0, 1000);
+  Test_Session slow_session;
+  slow_session.enable_reconnect (reactor, backoff, backoff, 100);
+  slow_session.open ("mock://slow", 0, 0, NULL, 0);
+  XIO_Hedged_Connection slow (&client);
+  slow.open (&slow_session, ctx, 0);
+  Test_Session fast_session;
+  fast_session.open ("mock://fast", 0, 0, NULL, 0);
+  XIO_Hedged_Connection fast (&client);
+  fast.open (&fast_session, ctx, 0);
+  settle (reactor, ctx);
+
+  // The first attempt goes to the slow server, the hedge wins
+  client.add_connection (&slow);
+  client.add_connection (&fast);
+
+  xio_vmsg out;
+  memset (&out, 0, sizeof (out));
+  int first = 1;
+  check (client.send_request (out, &first) == 0, "request sent");
+  settle (reactor, ctx);
+  check (slow_server.held.size () == 1 && client.responses == 0, "request held by the slow server");
+
+  for (int i = 0; i < 1000 && client.responses == 0; ++i)
+  {
+    run (reactor, backoff);
+  }
+  check (client.hedges () == 1 && fast_server.received == 1, "request hedged");
+  check (client.responses == 1 && client.last == &first && client.hedge_wins () == 1,
+         "hedge answered first");
+
+  slow_server.answer ();
+  settle (reactor, ctx);
+  check (client.responses == 1, "response of the loser not delivered");
+  check (slow.outstanding () == 0, "response of the loser released");
+
+  // A request whose connection goes away is retried on the other one
+  int second = 2;
+  check (client.send_request (out, &second) == 0, "second request sent");
+  settle (reactor, ctx);
+  check (slow_server.held.size () == 1, "second request held by the slow server");
+  slow.disconnect ();
+  settle (reactor, ctx);
+  check (client.responses == 2 && client.last == &second && client.failed == 0,
+         "failed request retried");
+  check (client.hedges () == 1 && fast_server.received == 2, "retry not counted as a hedge");
+
+  fast.close ();
+  fast_session.close ();
+  settle (reactor, ctx);
+  slow_server.close ();
+  fast_server.close ();
+  xio_ctx_close (ctx);
+
+  printf("%s\n", failures == 0 ? "PASSED" : "FAILED");
+  return failures == 0 ? 0 : -1;
+}
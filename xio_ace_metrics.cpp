@@ -0,0 +1,539 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "xio_ace_metrics.h"
+
+#include <ace/Guard_T.h>
+#include <ace/Thread_Mutex.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+bool xio_ace_metrics_enabled = false;
+__thread XIO_Metrics_Block* xio_ace_metrics_block = NULL;
+
+static ACE_Thread_Mutex metrics_lock;
+static std::vector <XIO_Metrics_Block*> metrics_blocks;
+static std::map <xio_context*, int> metrics_contexts;
+
+/// Name, type and help of the counters
+struct Metric_Info
+{
+  const char* name;
+  const char* help;
+  /// Unit conversion of the exported value
+  double scale;
+};
+
+static const Metric_Info METRIC_INFO[XIO_METRICS] =
+{
+  { "xio_reactor_fd_events_total", "Accelio handlers called by the reactor", 1 },
+  { "xio_reactor_busy_seconds_total", "Time spent in accelio handlers, its rate is the loop utilization", 1e-9 },
+  { "xio_msgs_received_total", "Messages passed to on_msg", 1 },
+  { "xio_send_completes_total", "Messages passed to on_msg_send_complete", 1 },
+  { "xio_msg_errors_total", "Messages passed to on_msg_error", 1 },
+  { "xio_server_sessions_admitted_total", "Sessions admitted by servers", 1 },
+  { "xio_server_sessions_rejected_total", "Sessions rejected by server limits", 1 },
+  { "xio_server_requests_admitted_total", "Requests admitted by servers", 1 },
+  { "xio_server_requests_rejected_total", "Requests rejected by server limits", 1 },
+  { "xio_server_requests_deferred_total", "Requests dispatched by servers after their callback returned", 1 },
+  { "xio_client_requests_sent_total", "Requests sent by connections", 1 },
+  { "xio_connections_established_total", "Connections established", 1 },
+  { "xio_connections_closed_total", "Connections closed", 1 },
+  { "xio_connections_failed_total", "Connections disconnected, refused or failed", 1 },
+  { "xio_client_reconnects_total", "Reconnect attempts", 1 },
+  { "xio_session_teardowns_total", "Sessions torn down", 1 },
+};
+
+/// Index of a context, called with metrics_lock held
+static int context_index (struct xio_context* ctx)
+{
+  std::map <xio_context*, int>::iterator it = metrics_contexts.find (ctx);
+  if (it == metrics_contexts.end ())
+  {
+    int index = static_cast <int> (metrics_contexts.size ());
+    it = metrics_contexts.insert (std::make_pair (ctx, index)).first;
+  }
+  return it->second;
+}
+
+/// The counter hook of the wrappers
+static void metric_add_hook (int metric, uint64_t n)
+{
+  xio_ace_metric_add (static_cast <XIO_Metric> (metric), n);
+}
+
+void xio_ace_metrics_enable (bool enable)
+{
+  xio_ace_metrics_enabled = enable;
+  xio_ace_hooks.metric_add = enable ? metric_add_hook : NULL;
+  xio_ace_hooks.session_event = enable ? xio_ace_metrics_session_event : NULL;
+}
+
+XIO_Metrics_Block* xio_ace_metrics_thread_block ()
+{
+  if (xio_ace_metrics_block)
+  {
+    return xio_ace_metrics_block;
+  }
+
+  void* mem = NULL;
+  if (posix_memalign (&mem, 64, sizeof (XIO_Metrics_Block)) != 0)
+  {
+    abort ();
+  }
+  XIO_Metrics_Block* block = reinterpret_cast <XIO_Metrics_Block*> (mem);
+  memset (block, 0, sizeof (XIO_Metrics_Block));
+  block->context = -1;
+
+  // Blocks outlive their threads, the counts stay in the totals
+  ACE_GUARD_RETURN (ACE_Thread_Mutex, guard, metrics_lock, block);
+  struct xio_context* ctx = xio_ace_ctx_current ();
+  if (ctx)
+  {
+    block->context = context_index (ctx);
+  }
+  metrics_blocks.push_back (block);
+  xio_ace_metrics_block = block;
+  return block;
+}
+
+void xio_ace_metrics_bind_context (struct xio_context* ctx)
+{
+  XIO_Metrics_Block* block = xio_ace_metrics_thread_block ();
+
+  ACE_GUARD (ACE_Thread_Mutex, guard, metrics_lock);
+  block->context = context_index (ctx);
+}
+
+void xio_ace_metrics_session_event (xio_session_event_data* data)
+{
+  switch (data->event)
+  {
+  case XIO_SESSION_CONNECTION_ESTABLISHED_EVENT:
+    xio_ace_metric_add (XIO_METRIC_CONNECTIONS_ESTABLISHED);
+    break;
+  case XIO_SESSION_CONNECTION_CLOSED_EVENT:
+    xio_ace_metric_add (XIO_METRIC_CONNECTIONS_CLOSED);
+    break;
+  case XIO_SESSION_CONNECTION_DISCONNECTED_EVENT:
+  case XIO_SESSION_CONNECTION_REFUSED_EVENT:
+  case XIO_SESSION_CONNECTION_ERROR_EVENT:
+    xio_ace_metric_add (XIO_METRIC_CONNECTIONS_FAILED);
+    break;
+  case XIO_SESSION_TEARDOWN_EVENT:
+    xio_ace_metric_add (XIO_METRIC_SESSION_TEARDOWNS);
+    break;
+  default:
+    break;
+  }
+}
+
+void xio_ace_metrics_render (std::string& out)
+{
+  // Sum the blocks per context, -1 collects the other threads
+  std::map <int, std::vector <uint64_t> > totals;
+  {
+    ACE_GUARD (ACE_Thread_Mutex, guard, metrics_lock);
+    for (size_t i = 0; i < metrics_blocks.size (); ++i)
+    {
+      std::vector <uint64_t>& total = totals[metrics_blocks[i]->context];
+      total.resize (XIO_METRICS, 0);
+      for (int m = 0; m < XIO_METRICS; ++m)
+      {
+        total[m] += __atomic_load_n (&metrics_blocks[i]->values[m], __ATOMIC_RELAXED);
+      }
+    }
+  }
+
+  char line[256];
+  for (int m = 0; m < XIO_METRICS; ++m)
+  {
+    const Metric_Info& info = METRIC_INFO[m];
+    snprintf (line, sizeof (line), "# HELP %s %s\n# TYPE %s counter\n", info.name, info.help, info.name);
+    out += line;
+
+    for (std::map <int, std::vector <uint64_t> >::iterator it = totals.begin (); it != totals.end (); ++it)
+    {
+      char ctx[16];
+      if (it->first < 0)
+      {
+        snprintf (ctx, sizeof (ctx), "none");
+      }
+      else
+      {
+        snprintf (ctx, sizeof (ctx), "%d", it->first);
+      }
+
+      if (info.scale == 1)
+      {
+        snprintf (line, sizeof (line), "%s{ctx=\"%s\"} %llu\n", info.name, ctx,
+                  (unsigned long long) it->second[m]);
+      }
+      else
+      {
+        snprintf (line, sizeof (line), "%s{ctx=\"%s\"} %.9f\n", info.name, ctx,
+                  it->second[m] * info.scale);
+      }
+      out += line;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////
+///  XIO_Metrics_Request
+////////////////////////////////////////////////////////
+/**
+ * An HTTP connection to the exporter, answered once the request header
+ * is read and closed after the response
+ */
+class XIO_Metrics_Request : public ACE_Event_Handler
+{
+public:
+  XIO_Metrics_Request (XIO_Metrics_Exporter* exporter, ACE_HANDLE fd)
+  : ACE_Event_Handler (NULL, ACE_Event_Handler::LO_PRIORITY)
+  , exporter_ (exporter)
+  , fd_ (fd)
+  , sent_ (0)
+  {
+  }
+
+  virtual ~XIO_Metrics_Request ()
+  {
+    ::close (this->fd_);
+  }
+
+  virtual ACE_HANDLE get_handle () const
+  {
+    return this->fd_;
+  }
+
+  virtual int handle_input (ACE_HANDLE fd)
+  {
+    char buf[1024];
+    ssize_t len = ::recv (fd, buf, sizeof (buf), 0);
+    if (len < 0 && (errno == EAGAIN || errno == EINTR))
+    {
+      return 0;
+    }
+    if (len <= 0)
+    {
+      return -1;
+    }
+
+    this->request_.append (buf, len);
+    if (this->request_.find ("\r\n\r\n") == std::string::npos &&
+        this->request_.find ("\n\n") == std::string::npos)
+    {
+      // Header incomplete, bound what a client may make us buffer
+      return this->request_.size () < 8192 ? 0 : -1;
+    }
+
+    std::string body;
+    this->exporter_->render (body);
+
+    char header[256];
+    snprintf (header, sizeof (header),
+              "HTTP/1.0 200 OK\r\n"
+              "Content-Type: text/plain; version=0.0.4\r\n"
+              "Content-Length: %lu\r\n"
+              "Connection: close\r\n\r\n",
+              (unsigned long) body.size ());
+    this->response_ = header + body;
+
+    this->reactor ()->remove_handler (this, ACE_Event_Handler::READ_MASK | ACE_Event_Handler::DONT_CALL);
+    return this->reactor ()->register_handler (this, ACE_Event_Handler::WRITE_MASK);
+  }
+
+  virtual int handle_output (ACE_HANDLE fd)
+  {
+    ssize_t len = ::send (fd, this->response_.data () + this->sent_,
+                          this->response_.size () - this->sent_, MSG_NOSIGNAL);
+    if (len < 0 && (errno == EAGAIN || errno == EINTR))
+    {
+      return 0;
+    }
+    if (len <= 0)
+    {
+      return -1;
+    }
+
+    this->sent_ += len;
+    return this->sent_ < this->response_.size () ? 0 : -1;
+  }
+
+  virtual int handle_close (ACE_HANDLE fd, ACE_Reactor_Mask mask)
+  {
+    delete this;
+    return 0;
+  }
+
+private:
+  XIO_Metrics_Exporter* exporter_;
+  ACE_HANDLE fd_;
+  std::string request_;
+  std::string response_;
+  size_t sent_;
+};
+
+////////////////////////////////////////////////////////
+///  XIO_Metrics_Exporter
+////////////////////////////////////////////////////////
+XIO_Metrics_Exporter::XIO_Metrics_Exporter ()
+: ACE_Event_Handler (NULL, ACE_Event_Handler::LO_PRIORITY)
+, reactor_ (NULL)
+, fd_ (ACE_INVALID_HANDLE)
+{
+}
+
+XIO_Metrics_Exporter::~XIO_Metrics_Exporter ()
+{
+  if (this->fd_ != ACE_INVALID_HANDLE)
+  {
+    this->close ();
+  }
+}
+
+int
+XIO_Metrics_Exporter::open (ACE_Reactor* reactor, const char* address)
+{
+  if (this->fd_ != ACE_INVALID_HANDLE || address == NULL)
+  {
+    return -1;
+  }
+
+  ACE_HANDLE fd = ACE_INVALID_HANDLE;
+  std::string addr (address);
+  if (addr.compare (0, 5, "unix:") == 0)
+  {
+    sockaddr_un sun;
+    memset (&sun, 0, sizeof (sun));
+    sun.sun_family = AF_UNIX;
+    std::string path = addr.substr (5);
+    if (path.empty () || path.size () >= sizeof (sun.sun_path))
+    {
+      return -1;
+    }
+    strcpy (sun.sun_path, path.c_str ());
+
+    fd = ::socket (AF_UNIX, SOCK_STREAM, 0);
+    unlink (path.c_str ());
+    if (fd < 0 || ::bind (fd, reinterpret_cast <sockaddr*> (&sun), sizeof (sun)) != 0)
+    {
+      if (fd >= 0)
+      {
+        ::close (fd);
+      }
+      return -1;
+    }
+    this->unix_path_ = path;
+  }
+  else
+  {
+    std::string::size_type colon = addr.rfind (':');
+    if (colon == std::string::npos)
+    {
+      return -1;
+    }
+    std::string host = addr.substr (0, colon);
+    std::string port = addr.substr (colon + 1);
+
+    addrinfo hints;
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* info = NULL;
+    if (getaddrinfo (host.empty () ? NULL : host.c_str (), port.c_str (), &hints, &info) != 0)
+    {
+      return -1;
+    }
+
+    fd = ::socket (info->ai_family, SOCK_STREAM, 0);
+    int one = 1;
+    if (fd < 0 ||
+        setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one)) != 0 ||
+        ::bind (fd, info->ai_addr, info->ai_addrlen) != 0)
+    {
+      if (fd >= 0)
+      {
+        ::close (fd);
+      }
+      freeaddrinfo (info);
+      return -1;
+    }
+    freeaddrinfo (info);
+  }
+
+  fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+  if (::listen (fd, 16) != 0)
+  {
+    ::close (fd);
+    return -1;
+  }
+
+  this->fd_ = fd;
+  this->reactor_ = reactor;
+  this->reactor (reactor);
+  if (reactor->register_handler (this, ACE_Event_Handler::ACCEPT_MASK) != 0)
+  {
+    this->close ();
+    return -1;
+  }
+  return 0;
+}
+
+int
+XIO_Metrics_Exporter::close ()
+{
+  if (this->fd_ == ACE_INVALID_HANDLE)
+  {
+    return 0;
+  }
+
+  if (this->reactor_)
+  {
+    this->reactor_->remove_handler (this, ACE_Event_Handler::ACCEPT_MASK | ACE_Event_Handler::DONT_CALL);
+  }
+  int retval = ::close (this->fd_);
+  if (!this->unix_path_.empty ())
+  {
+    unlink (this->unix_path_.c_str ());
+    this->unix_path_.clear ();
+  }
+  this->fd_ = ACE_INVALID_HANDLE;
+  this->reactor_ = NULL;
+  return retval;
+}
+
+void
+XIO_Metrics_Exporter::add_server (const std::string& name, XIO_Server* server)
+{
+  this->servers_.push_back (std::make_pair (name, server));
+}
+
+void
+XIO_Metrics_Exporter::add_connection (const std::string& name, XIO_Connection* conn)
+{
+  this->connections_.push_back (std::make_pair (name, conn));
+}
+
+void
+XIO_Metrics_Exporter::render (std::string& out)
+{
+  xio_ace_metrics_render (out);
+
+  char line[256];
+  if (!this->servers_.empty ())
+  {
+    out += "# HELP xio_server_sessions Sessions of a server\n# TYPE xio_server_sessions gauge\n";
+    for (size_t i = 0; i < this->servers_.size (); ++i)
+    {
+      snprintf (line, sizeof (line), "xio_server_sessions{server=\"%s\"} %lu\n",
+                this->servers_[i].first.c_str (),
+                (unsigned long) this->servers_[i].second->load ().sessions);
+      out += line;
+    }
+
+    out += "# HELP xio_server_requests Outstanding requests of a server\n# TYPE xio_server_requests gauge\n";
+    for (size_t i = 0; i < this->servers_.size (); ++i)
+    {
+      snprintf (line, sizeof (line), "xio_server_requests{server=\"%s\"} %lu\n",
+                this->servers_[i].first.c_str (),
+                (unsigned long) this->servers_[i].second->load ().requests);
+      out += line;
+    }
+
+    out += "# HELP xio_server_deferred_requests Requests queued for prioritized dispatch\n# TYPE xio_server_deferred_requests gauge\n";
+    for (size_t i = 0; i < this->servers_.size (); ++i)
+    {
+      snprintf (line, sizeof (line), "xio_server_deferred_requests{server=\"%s\"} %lu\n",
+                this->servers_[i].first.c_str (),
+                (unsigned long) this->servers_[i].second->load ().deferred);
+      out += line;
+    }
+  }
+
+  if (!this->connections_.empty ())
+  {
+    out += "# HELP xio_connection_requests Outstanding requests of a connection\n# TYPE xio_connection_requests gauge\n";
+    for (size_t i = 0; i < this->connections_.size (); ++i)
+    {
+      snprintf (line, sizeof (line), "xio_connection_requests{connection=\"%s\"} %lu\n",
+                this->connections_[i].first.c_str (),
+                (unsigned long) this->connections_[i].second->outstanding ());
+      out += line;
+    }
+  }
+}
+
+ACE_HANDLE
+XIO_Metrics_Exporter::get_handle () const
+{
+  return this->fd_;
+}
+
+int
+XIO_Metrics_Exporter::handle_input (ACE_HANDLE fd)
+{
+  ACE_HANDLE client = ::accept (fd, NULL, NULL);
+  if (client < 0)
+  {
+    return 0;
+  }
+
+  fcntl (client, F_SETFL, fcntl (client, F_GETFL) | O_NONBLOCK);
+  XIO_Metrics_Request* request = new XIO_Metrics_Request (this, client);
+  request->reactor (this->reactor_);
+  if (this->reactor_->register_handler (request, ACE_Event_Handler::READ_MASK) != 0)
+  {
+    delete request;
+  }
+  return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XIO_ACE_METRICS_H
+#define XIO_ACE_METRICS_H
+
+#include "xio_ace_session.h"
+#include "xio_ace_trace.h"
+
+#include <ace/Event_Handler.h>
+#include <ace/Reactor.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Metrics.
+ *
+ * The wrappers count events in a block of counters owned by the calling
+ * thread: a relaxed store of the incremented value, no locked
+ * instruction and no shared cache line on the data path. The exporter
+ * sums the blocks per context on demand. A thread is attributed to the
+ * context it opened with xio_ace_ctx_open (contexts are used on the
+ * thread that opened them).
+ */
+
+/// The counters
+enum XIO_Metric
+{
+  /// Accelio handlers called by the reactor
+  XIO_METRIC_FD_EVENTS = 0,
+  /// Time spent in accelio handlers (callbacks included) in nanoseconds
+  XIO_METRIC_FD_BUSY_NS,
+  /// on_msg calls
+  XIO_METRIC_MSGS_RECEIVED,
+  /// on_msg_send_complete calls
+  XIO_METRIC_SEND_COMPLETES,
+  /// on_msg_error calls
+  XIO_METRIC_MSG_ERRORS,
+  /// Sessions admitted / rejected by servers
+  XIO_METRIC_SESSIONS_ADMITTED,
+  XIO_METRIC_SESSIONS_REJECTED,
+  /// Requests admitted / rejected by servers
+  XIO_METRIC_REQUESTS_ADMITTED,
+  XIO_METRIC_REQUESTS_REJECTED,
+  /// Requests dispatched by servers after their callback returned
+  XIO_METRIC_REQUESTS_DEFERRED,
+  /// Requests sent by connections
+  XIO_METRIC_REQUESTS_SENT,
+  /// Connection session events
+  XIO_METRIC_CONNECTIONS_ESTABLISHED,
+  XIO_METRIC_CONNECTIONS_CLOSED,
+  XIO_METRIC_CONNECTIONS_FAILED,
+  /// Reconnect attempts
+  XIO_METRIC_RECONNECTS,
+  /// Session teardowns
+  XIO_METRIC_SESSION_TEARDOWNS,
+  XIO_METRICS
+};
+
+/// The counters of a thread, a cache line multiple
+struct XIO_Metrics_Block
+{
+  uint64_t values[XIO_METRICS];
+  /// Index of the context of the thread, -1 if none
+  int context;
+} __attribute__ ((aligned (64)));
+
+/// Whether metrics are collected (off by default)
+extern bool xio_ace_metrics_enabled;
+
+/// Block of the calling thread, NULL until it counted
+extern __thread XIO_Metrics_Block* xio_ace_metrics_block;
+
+/// Enable or disable metrics collection
+void xio_ace_metrics_enable (bool enable);
+
+/// Create the block of the calling thread
+XIO_Metrics_Block* xio_ace_metrics_thread_block ();
+
+/// Attribute the calling thread to a context (by default the one it
+/// opened last with xio_ace_ctx_open)
+void xio_ace_metrics_bind_context (struct xio_context* ctx);
+
+/// Add to a counter of the calling thread
+inline void xio_ace_metric_add (XIO_Metric metric, uint64_t n = 1)
+{
+  if (!xio_ace_metrics_enabled)
+  {
+    return;
+  }
+
+  XIO_Metrics_Block* block = xio_ace_metrics_block;
+  if (block == NULL)
+  {
+    block = xio_ace_metrics_thread_block ();
+  }
+  __atomic_store_n (&block->values[metric], block->values[metric] + n, __ATOMIC_RELAXED);
+}
+
+/// Start time for a duration counter, 0 if metrics are disabled
+inline uint64_t xio_ace_metrics_now ()
+{
+  return xio_ace_metrics_enabled ? xio_ace_trace_now () : 0;
+}
+
+/// Count a session event
+void xio_ace_metrics_session_event (xio_session_event_data* data);
+
+/**
+ * Append all counters in the Prometheus text format, one sample per
+ * context
+ */
+void xio_ace_metrics_render (std::string& out);
+
+
+/**
+ * Serves the metrics in the Prometheus text format over HTTP.
+ *
+ * Listens on a local TCP or Unix socket registered with a reactor at
+ * low priority. Every request is answered with the counters and the
+ * gauges of the added servers and connections, which are read on the
+ * reactor thread - use the reactor of their context.
+ */
+class XIO_Metrics_Exporter : public ACE_Event_Handler
+{
+public:
+  XIO_Metrics_Exporter ();
+  virtual ~XIO_Metrics_Exporter ();
+
+  /**
+   * Start listening
+   *
+   * @param reactor The reactor serving the requests
+   * @param address "unix:<path>" or "<host>:<port>", use a loopback host
+   *
+   * @return 0 on success, -1 upon error
+   */
+  int open (ACE_Reactor* reactor, const char* address);
+
+  /// Stop listening
+  int close ();
+
+  /// Export the load of a server
+  void add_server (const std::string& name, XIO_Server* server);
+
+  /// Export the outstanding requests of a connection
+  void add_connection (const std::string& name, XIO_Connection* conn);
+
+  /// Append the metrics, subclasses may add their own
+  virtual void render (std::string& out);
+
+  /// ACE_Event_Handler
+  virtual ACE_HANDLE get_handle () const;
+  virtual int handle_input (ACE_HANDLE fd);
+
+private:
+  ACE_Reactor* reactor_;
+  ACE_HANDLE fd_;
+  std::string unix_path_;
+  std::vector <std::pair <std::string, XIO_Server*> > servers_;
+  std::vector <std::pair <std::string, XIO_Connection*> > connections_;
+};
+
+#endif // XIO_ACE_METRICS_H
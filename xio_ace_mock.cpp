@@ -0,0 +1,935 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "xio_ace_mock.h"
+
+#include <ace/Guard_T.h>
+#include <ace/Thread_Mutex.h>
+
+#include <algorithm>
+#include <deque>
+#include <list>
+#include <map>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <vector>
+
+/// A delivery queued on a context
+struct Mock_Event
+{
+  enum Kind
+  {
+    /// Server: a client connection arrived (conn is the client's)
+    CONNECT,
+    /// Client: the server accepted the connection
+    ESTABLISHED,
+    /// Client: the server rejected the session (arg: xio_status)
+    REJECTED,
+    /// Client: no server is bound to the URI
+    REFUSED,
+    /// A message arrived
+    DELIVER,
+    /// A response or one way message was sent
+    SEND_COMPLETE,
+    /// A response could not be sent (arg: xio_status)
+    SEND_ERROR,
+    /// The connection broke
+    DISCONNECTED,
+    /// The connection was closed
+    CLOSED
+  };
+
+  Kind kind;
+  xio_connection* conn;
+  xio_msg* msg;
+  int arg;
+};
+
+struct xio_context
+{
+  xio_loop_ops loop_ops;
+  void* loop;
+  int fd;
+  ACE_Thread_Mutex lock;
+  std::deque <Mock_Event> events;
+};
+
+struct xio_server
+{
+  xio_context* ctx;
+  xio_session_ops ops;
+  void* user_context;
+  std::string uri;
+};
+
+struct xio_session
+{
+  xio_session_type type;
+  xio_session_ops ops;
+  /// Context of the session callbacks (the server's on the server side)
+  void* user_context;
+  std::string uri;
+  /// Private data sent with the session request
+  std::vector <char> private_data;
+  uint64_t next_sn;
+  /// The server session of a client session and vice versa
+  xio_session* peer;
+  /// Server side: set by xio_accept / xio_reject
+  bool accepted;
+  bool rejected;
+  xio_status reason;
+  bool established;
+  bool closed;
+  /// Number of connections not closed yet
+  int connections;
+};
+
+struct xio_connection
+{
+  xio_session* session;
+  xio_context* ctx;
+  void* user_context;
+  /// The other side, NULL until established
+  xio_connection* peer;
+  bool broken;
+  bool closed;
+  /// Requests waiting for their response
+  std::list <xio_msg*> outstanding;
+  /// Requests sent before the connection was established
+  std::list <xio_msg*> unsent;
+};
+
+struct xio_mr
+{
+  void* addr;
+  size_t length;
+};
+
+/**
+ * A received message.
+ * The payload is a copy of the sender's header and data, the request of
+ * a server is kept until its response completed.
+ */
+struct Mock_Msg
+{
+  xio_msg msg;
+  /// The sender's message
+  xio_msg* origin;
+  /// The connection the message was received on
+  xio_connection* conn;
+  size_t header_len;
+  size_t data_len;
+  std::vector <char> payload;
+};
+
+static ACE_Thread_Mutex mock_lock;
+static std::map <std::string, xio_server*> mock_servers;
+static int mock_contexts = 0;
+/// Freed when the last context is closed
+static std::vector <xio_session*> mock_sessions;
+static std::vector <xio_connection*> mock_connections;
+
+/// Queue an event on a context and wake its handler
+static void post (xio_context* ctx, Mock_Event::Kind kind, xio_connection* conn, xio_msg* msg, int arg)
+{
+  Mock_Event event = { kind, conn, msg, arg };
+  bool wake;
+  {
+    ACE_GUARD (ACE_Thread_Mutex, guard, ctx->lock);
+    wake = ctx->events.empty ();
+    ctx->events.push_back (event);
+  }
+
+  if (wake)
+  {
+    uint64_t one = 1;
+    ssize_t written = write (ctx->fd, &one, sizeof (one));
+    (void) written;
+  }
+}
+
+/// Context of the message callbacks of a connection
+static void* msg_context (xio_connection* conn)
+{
+  if (conn->session->type == XIO_SESSION_REQ && conn->user_context)
+  {
+    return conn->user_context;
+  }
+  return conn->session->user_context;
+}
+
+static void session_event (xio_session* session,
+                           xio_connection* conn,
+                           xio_session_event event,
+                           xio_status reason)
+{
+  if (session->ops.on_session_event == NULL)
+  {
+    return;
+  }
+
+  xio_session_event_data data;
+  memset (&data, 0, sizeof (data));
+  data.conn = conn;
+  data.conn_user_context = conn ? conn->user_context : NULL;
+  data.event = event;
+  data.reason = reason;
+  session->ops.on_session_event (session, &data, session->user_context);
+}
+
+static xio_server* find_server (const std::string& uri)
+{
+  ACE_GUARD_RETURN (ACE_Thread_Mutex, guard, mock_lock, NULL);
+  std::map <std::string, xio_server*>::iterator it = mock_servers.find (uri);
+  return it == mock_servers.end () ? NULL : it->second;
+}
+
+static xio_session* new_session (xio_session_type type,
+                                 const xio_session_ops& ops,
+                                 const char* uri,
+                                 void* user_context)
+{
+  xio_session* session = new xio_session;
+  session->type = type;
+  session->ops = ops;
+  session->user_context = user_context;
+  session->uri = uri;
+  session->next_sn = 0;
+  session->peer = NULL;
+  session->accepted = false;
+  session->rejected = false;
+  session->reason = XIO_E_SUCCESS;
+  session->established = false;
+  session->closed = false;
+  session->connections = 0;
+
+  ACE_GUARD_RETURN (ACE_Thread_Mutex, guard, mock_lock, session);
+  mock_sessions.push_back (session);
+  return session;
+}
+
+static xio_connection* new_connection (xio_session* session, xio_context* ctx, void* user_context)
+{
+  xio_connection* conn = new xio_connection;
+  conn->session = session;
+  conn->ctx = ctx;
+  conn->user_context = user_context;
+  conn->peer = NULL;
+  conn->broken = false;
+  conn->closed = false;
+  ++session->connections;
+
+  ACE_GUARD_RETURN (ACE_Thread_Mutex, guard, mock_lock, conn);
+  mock_connections.push_back (conn);
+  return conn;
+}
+
+static uint64_t next_sn (xio_session* session)
+{
+  ACE_GUARD_RETURN (ACE_Thread_Mutex, guard, mock_lock, 0);
+  return session->next_sn++;
+}
+
+/// Copy a message to the peer of a connection
+static void deliver (xio_connection* from, xio_msg* msg, xio_msg* request)
+{
+  xio_connection* to = from->peer;
+
+  Mock_Msg* copy = new Mock_Msg;
+  memset (&copy->msg, 0, sizeof (copy->msg));
+  copy->origin = msg;
+  copy->conn = to;
+  copy->msg.type = msg->type;
+  copy->msg.sn = msg->sn;
+  copy->msg.request = request;
+
+  copy->header_len = msg->out.header.iov_len;
+  copy->data_len = 0;
+  for (size_t i = 0; i < msg->out.data_iovlen; ++i)
+  {
+    copy->data_len += msg->out.data_iov[i].iov_len;
+  }
+  copy->payload.resize (copy->header_len + copy->data_len + 1);
+
+  char* p = &copy->payload[0];
+  if (copy->header_len)
+  {
+    memcpy (p, msg->out.header.iov_base, copy->header_len);
+    copy->msg.in.header.iov_base = p;
+    copy->msg.in.header.iov_len = copy->header_len;
+    p += copy->header_len;
+  }
+  for (size_t i = 0; i < msg->out.data_iovlen; ++i)
+  {
+    memcpy (p, msg->out.data_iov[i].iov_base, msg->out.data_iov[i].iov_len);
+    p += msg->out.data_iov[i].iov_len;
+  }
+
+  post (to->ctx, Mock_Event::DELIVER, to, &copy->msg, 0);
+}
+
+/// Fail the outstanding requests and report the end of a connection
+static void connection_gone (xio_connection* conn, xio_session_event event, xio_status reason)
+{
+  xio_session* session = conn->session;
+
+  std::list <xio_msg*> flushed;
+  flushed.swap (conn->outstanding);
+  conn->unsent.clear ();
+  for (std::list <xio_msg*>::iterator it = flushed.begin (); it != flushed.end (); ++it)
+  {
+    if (session->ops.on_msg_error)
+    {
+      session->ops.on_msg_error (session, XIO_E_MSG_FLUSHED, *it, msg_context (conn));
+    }
+  }
+
+  session_event (session, conn, event, reason);
+  if (--session->connections > 0)
+  {
+    return;
+  }
+
+  if (session->type == XIO_SESSION_REP)
+  {
+    // A later connect of the client creates a new session
+    if (session->peer && session->peer->peer == session)
+    {
+      session->peer->peer = NULL;
+    }
+    session->closed = true;
+  }
+  session_event (session, NULL, XIO_SESSION_TEARDOWN_EVENT, reason);
+}
+
+/// A client connection arrived at a server
+static void on_connect (xio_connection* conn)
+{
+  xio_session* client = conn->session;
+  xio_server* server = find_server (client->uri);
+  if (server == NULL)
+  {
+    conn->closed = true;
+    post (conn->ctx, Mock_Event::REFUSED, conn, NULL, XIO_E_SESSION_REFUSED);
+    return;
+  }
+
+  xio_session* session = client->peer;
+  if (session == NULL)
+  {
+    session = new_session (XIO_SESSION_REP, server->ops, client->uri.c_str (), server->user_context);
+    session->peer = client;
+    client->peer = session;
+
+    if (server->ops.on_new_session)
+    {
+      xio_new_session_req req;
+      memset (&req, 0, sizeof (req));
+      req.uri = &session->uri[0];
+      req.uri_len = session->uri.size ();
+      req.user_context = client->private_data.empty () ? NULL : &client->private_data[0];
+      req.user_context_len = client->private_data.size ();
+      server->ops.on_new_session (session, &req, server->user_context);
+    }
+  }
+
+  if (session->rejected)
+  {
+    client->peer = NULL;
+    session->closed = true;
+    conn->closed = true;
+    post (conn->ctx, Mock_Event::REJECTED, conn, NULL, session->reason);
+    return;
+  }
+
+  session->accepted = true;
+  xio_connection* peer = new_connection (session, server->ctx, NULL);
+  peer->peer = conn;
+  conn->peer = peer;
+  session_event (session, peer, XIO_SESSION_NEW_CONNECTION_EVENT, XIO_E_SUCCESS);
+  post (conn->ctx, Mock_Event::ESTABLISHED, conn, NULL, 0);
+}
+
+/// The server accepted a client connection
+static void on_established (xio_connection* conn)
+{
+  xio_session* session = conn->session;
+  if (!session->established)
+  {
+    session->established = true;
+    if (session->ops.on_session_established)
+    {
+      xio_new_session_rsp rsp;
+      memset (&rsp, 0, sizeof (rsp));
+      session->ops.on_session_established (session, &rsp, session->user_context);
+    }
+  }
+  session_event (session, conn, XIO_SESSION_CONNECTION_ESTABLISHED_EVENT, XIO_E_SUCCESS);
+
+  // Requests sent while connecting
+  std::list <xio_msg*> unsent;
+  unsent.swap (conn->unsent);
+  for (std::list <xio_msg*>::iterator it = unsent.begin (); it != unsent.end (); ++it)
+  {
+    deliver (conn, *it, NULL);
+  }
+}
+
+/// A message arrived
+static void on_deliver (xio_connection* conn, Mock_Msg* copy)
+{
+  xio_session* session = conn->session;
+  xio_msg* msg = &copy->msg;
+
+  if (msg->type == XIO_MSG_TYPE_RSP)
+  {
+    std::list <xio_msg*>::iterator it =
+      std::find (conn->outstanding.begin (), conn->outstanding.end (), msg->request);
+    if (it == conn->outstanding.end ())
+    {
+      // Already flushed
+      delete copy;
+      return;
+    }
+    conn->outstanding.erase (it);
+  }
+
+  if (session->ops.on_msg == NULL)
+  {
+    if (msg->type != XIO_MSG_TYPE_REQ)
+    {
+      delete copy;
+    }
+    return;
+  }
+
+  if (copy->data_len)
+  {
+    char* data = &copy->payload[copy->header_len];
+    msg->in.data_iovlen = 1;
+    msg->in.data_iov[0].iov_len = copy->data_len;
+    if (session->ops.assign_data_in_buf)
+    {
+      session->ops.assign_data_in_buf (msg, msg_context (conn));
+    }
+    if (msg->in.data_iov[0].iov_base)
+    {
+      memcpy (msg->in.data_iov[0].iov_base, data, copy->data_len);
+    }
+    else
+    {
+      msg->in.data_iov[0].iov_base = data;
+    }
+  }
+
+  session->ops.on_msg (session, msg, 0, msg_context (conn));
+}
+
+/// A sent response or one way message completed or failed
+static void on_sent (xio_connection* conn, xio_msg* msg, bool sent, int status)
+{
+  xio_session* session = conn->session;
+
+  // The request is released with its response, the callback may free msg
+  Mock_Msg* request = msg->type == XIO_MSG_TYPE_RSP ? reinterpret_cast <Mock_Msg*> (msg->request) : NULL;
+  if (sent && session->ops.on_msg_send_complete)
+  {
+    session->ops.on_msg_send_complete (session, msg, msg_context (conn));
+  }
+  else if (!sent && session->ops.on_msg_error)
+  {
+    session->ops.on_msg_error (session, static_cast <xio_status> (status), msg, msg_context (conn));
+  }
+  delete request;
+}
+
+static void dispatch (const Mock_Event& event)
+{
+  xio_connection* conn = event.conn;
+  if (conn->session->closed)
+  {
+    if (event.kind == Mock_Event::DELIVER)
+    {
+      delete reinterpret_cast <Mock_Msg*> (event.msg);
+    }
+    return;
+  }
+
+  switch (event.kind)
+  {
+  case Mock_Event::CONNECT:
+    if (!conn->closed)
+    {
+      on_connect (conn);
+    }
+    break;
+  case Mock_Event::ESTABLISHED:
+    if (!conn->closed)
+    {
+      on_established (conn);
+    }
+    break;
+  case Mock_Event::REJECTED:
+    connection_gone (conn, XIO_SESSION_REJECT_EVENT, static_cast <xio_status> (event.arg));
+    break;
+  case Mock_Event::REFUSED:
+    connection_gone (conn, XIO_SESSION_CONNECTION_REFUSED_EVENT, static_cast <xio_status> (event.arg));
+    break;
+  case Mock_Event::DELIVER:
+    if (conn->closed)
+    {
+      delete reinterpret_cast <Mock_Msg*> (event.msg);
+    }
+    else
+    {
+      on_deliver (conn, reinterpret_cast <Mock_Msg*> (event.msg));
+    }
+    break;
+  case Mock_Event::SEND_COMPLETE:
+    on_sent (conn, event.msg, true, 0);
+    break;
+  case Mock_Event::SEND_ERROR:
+    on_sent (conn, event.msg, false, event.arg);
+    break;
+  case Mock_Event::DISCONNECTED:
+    if (!conn->closed)
+    {
+      session_event (conn->session, conn, XIO_SESSION_CONNECTION_DISCONNECTED_EVENT, XIO_E_SUCCESS);
+    }
+    break;
+  case Mock_Event::CLOSED:
+    connection_gone (conn, XIO_SESSION_CONNECTION_CLOSED_EVENT, XIO_E_SUCCESS);
+    break;
+  }
+}
+
+/// Loop handler of a context
+static void mock_handler (int fd, int events, void* data)
+{
+  xio_context* ctx = reinterpret_cast <xio_context*> (data);
+
+  uint64_t count;
+  ssize_t len = read (fd, &count, sizeof (count));
+  (void) len;
+
+  // Events posted by the callbacks are handled on the next wakeup
+  std::deque <Mock_Event> pending;
+  {
+    ACE_GUARD (ACE_Thread_Mutex, guard, ctx->lock);
+    pending.swap (ctx->events);
+  }
+  for (size_t i = 0; i < pending.size (); ++i)
+  {
+    dispatch (pending[i]);
+  }
+}
+
+////////////////////////////////////////////////////////
+///  Accelio API
+////////////////////////////////////////////////////////
+struct xio_context *xio_ctx_open (struct xio_loop_ops *loop_ops, void *ev_loop, int polling_timeout_us)
+{
+  xio_context* ctx = new xio_context;
+  ctx->loop_ops = *loop_ops;
+  ctx->loop = ev_loop;
+  ctx->fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (ctx->fd < 0 ||
+      ctx->loop_ops.ev_loop_add_cb (ev_loop, ctx->fd, XIO_POLLIN, mock_handler, ctx) != 0)
+  {
+    if (ctx->fd >= 0)
+    {
+      close (ctx->fd);
+    }
+    delete ctx;
+    return NULL;
+  }
+
+  ACE_GUARD_RETURN (ACE_Thread_Mutex, guard, mock_lock, ctx);
+  ++mock_contexts;
+  return ctx;
+}
+
+void xio_ctx_close (struct xio_context *ctx)
+{
+  ctx->loop_ops.ev_loop_del_cb (ctx->loop, ctx->fd);
+  close (ctx->fd);
+  for (size_t i = 0; i < ctx->events.size (); ++i)
+  {
+    if (ctx->events[i].kind == Mock_Event::DELIVER)
+    {
+      delete reinterpret_cast <Mock_Msg*> (ctx->events[i].msg);
+    }
+  }
+  delete ctx;
+
+  ACE_GUARD (ACE_Thread_Mutex, guard, mock_lock);
+  if (--mock_contexts > 0)
+  {
+    return;
+  }
+  for (size_t i = 0; i < mock_connections.size (); ++i)
+  {
+    delete mock_connections[i];
+  }
+  for (size_t i = 0; i < mock_sessions.size (); ++i)
+  {
+    delete mock_sessions[i];
+  }
+  mock_connections.clear ();
+  mock_sessions.clear ();
+}
+
+struct xio_server *xio_bind (struct xio_context *ctx,
+                             struct xio_session_ops *ops,
+                             const char *uri,
+                             uint16_t *src_port,
+                             uint32_t flags,
+                             void *cb_private_data)
+{
+  ACE_GUARD_RETURN (ACE_Thread_Mutex, guard, mock_lock, NULL);
+  if (ctx == NULL || uri == NULL || mock_servers.count (uri) > 0)
+  {
+    return NULL;
+  }
+
+  xio_server* server = new xio_server;
+  server->ctx = ctx;
+  server->ops = *ops;
+  server->user_context = cb_private_data;
+  server->uri = uri;
+  mock_servers[server->uri] = server;
+
+  if (src_port)
+  {
+    const char* port = strrchr (uri, ':');
+    *src_port = port ? static_cast <uint16_t> (atoi (port + 1)) : 0;
+  }
+  return server;
+}
+
+int xio_unbind (struct xio_server *server)
+{
+  ACE_GUARD_RETURN (ACE_Thread_Mutex, guard, mock_lock, -1);
+  mock_servers.erase (server->uri);
+  delete server;
+  return 0;
+}
+
+struct xio_session *xio_session_open (enum xio_session_type type,
+                                      struct xio_session_attr *attr,
+                                      const char *uri,
+                                      uint32_t initial_sn,
+                                      uint32_t flags,
+                                      void *cb_user_context)
+{
+  if (attr == NULL || attr->ses_ops == NULL || uri == NULL)
+  {
+    return NULL;
+  }
+
+  xio_session* session = new_session (type, *attr->ses_ops, uri, cb_user_context);
+  session->next_sn = initial_sn;
+  if (attr->user_context_len)
+  {
+    const char* data = reinterpret_cast <const char*> (attr->user_context);
+    session->private_data.assign (data, data + attr->user_context_len);
+  }
+  return session;
+}
+
+int xio_session_close (struct xio_session *session)
+{
+  if (session == NULL || session->closed)
+  {
+    return -1;
+  }
+  session->closed = true;
+
+  // Close the connections, only the peers are told
+  std::vector <xio_connection*> conns;
+  {
+    ACE_GUARD_RETURN (ACE_Thread_Mutex, guard, mock_lock, -1);
+    for (size_t i = 0; i < mock_connections.size (); ++i)
+    {
+      if (mock_connections[i]->session == session && !mock_connections[i]->closed)
+      {
+        conns.push_back (mock_connections[i]);
+      }
+    }
+  }
+  for (size_t i = 0; i < conns.size (); ++i)
+  {
+    conns[i]->closed = true;
+    xio_connection* peer = conns[i]->peer;
+    if (peer && !peer->closed)
+    {
+      peer->closed = true;
+      post (peer->ctx, Mock_Event::CLOSED, peer, NULL, 0);
+    }
+  }
+
+  if (session->peer && session->peer->peer == session)
+  {
+    session->peer->peer = NULL;
+  }
+  return 0;
+}
+
+struct xio_connection *xio_connect (struct xio_session *session,
+                                    struct xio_context *ctx,
+                                    uint32_t conn_idx,
+                                    void *conn_user_context)
+{
+  if (session == NULL || session->closed || ctx == NULL)
+  {
+    return NULL;
+  }
+
+  xio_connection* conn = new_connection (session, ctx, conn_user_context);
+  xio_server* server = find_server (session->uri);
+  if (server == NULL)
+  {
+    conn->closed = true;
+    post (ctx, Mock_Event::REFUSED, conn, NULL, XIO_E_SESSION_REFUSED);
+  }
+  else
+  {
+    post (server->ctx, Mock_Event::CONNECT, conn, NULL, 0);
+  }
+  return conn;
+}
+
+int xio_disconnect (struct xio_connection *conn)
+{
+  if (conn == NULL || conn->closed)
+  {
+    return -1;
+  }
+
+  conn->closed = true;
+  post (conn->ctx, Mock_Event::CLOSED, conn, NULL, 0);
+
+  xio_connection* peer = conn->peer;
+  if (peer && !peer->closed)
+  {
+    peer->closed = true;
+    post (peer->ctx, Mock_Event::CLOSED, peer, NULL, 0);
+  }
+  return 0;
+}
+
+int xio_send_request (struct xio_connection *conn, struct xio_msg *msg)
+{
+  if (conn == NULL || conn->closed || conn->broken)
+  {
+    return -1;
+  }
+
+  msg->sn = next_sn (conn->session);
+  msg->type = XIO_MSG_TYPE_REQ;
+  conn->outstanding.push_back (msg);
+  if (conn->peer)
+  {
+    deliver (conn, msg, NULL);
+  }
+  else
+  {
+    conn->unsent.push_back (msg);
+  }
+  return 0;
+}
+
+int xio_send_response (struct xio_msg *rsp)
+{
+  if (rsp == NULL || rsp->request == NULL)
+  {
+    return -1;
+  }
+
+  Mock_Msg* request = reinterpret_cast <Mock_Msg*> (rsp->request);
+  xio_connection* conn = request->conn;
+  rsp->type = XIO_MSG_TYPE_RSP;
+  rsp->sn = request->msg.sn;
+
+  if (conn->closed || conn->broken || conn->peer == NULL)
+  {
+    post (conn->ctx, Mock_Event::SEND_ERROR, conn, rsp, XIO_E_MSG_FLUSHED);
+    return 0;
+  }
+
+  deliver (conn, rsp, request->origin);
+  post (conn->ctx, Mock_Event::SEND_COMPLETE, conn, rsp, 0);
+  return 0;
+}
+
+int xio_send_msg (struct xio_connection *conn, struct xio_msg *msg)
+{
+  if (conn == NULL || conn->closed || conn->broken || conn->peer == NULL)
+  {
+    return -1;
+  }
+
+  msg->sn = next_sn (conn->session);
+  msg->type = XIO_MSG_TYPE_ONE_WAY;
+  deliver (conn, msg, NULL);
+  post (conn->ctx, Mock_Event::SEND_COMPLETE, conn, msg, 0);
+  return 0;
+}
+
+int xio_release_response (struct xio_msg *rsp)
+{
+  delete reinterpret_cast <Mock_Msg*> (rsp);
+  return 0;
+}
+
+int xio_release_msg (struct xio_msg *msg)
+{
+  delete reinterpret_cast <Mock_Msg*> (msg);
+  return 0;
+}
+
+int xio_accept (struct xio_session *session,
+                const char **portals_array,
+                size_t portals_array_len,
+                void *user_context,
+                size_t user_context_len)
+{
+  session->accepted = true;
+  return 0;
+}
+
+int xio_reject (struct xio_session *session,
+                enum xio_status reason,
+                void *user_context,
+                size_t user_context_len)
+{
+  session->rejected = true;
+  session->reason = reason;
+  return 0;
+}
+
+const char *xio_session_event_str (enum xio_session_event event)
+{
+  switch (event)
+  {
+  case XIO_SESSION_REJECT_EVENT:
+    return "session reject";
+  case XIO_SESSION_TEARDOWN_EVENT:
+    return "session teardown";
+  case XIO_SESSION_NEW_CONNECTION_EVENT:
+    return "new connection";
+  case XIO_SESSION_CONNECTION_ESTABLISHED_EVENT:
+    return "connection established";
+  case XIO_SESSION_CONNECTION_TEARDOWN_EVENT:
+    return "connection teardown";
+  case XIO_SESSION_CONNECTION_CLOSED_EVENT:
+    return "connection closed";
+  case XIO_SESSION_CONNECTION_DISCONNECTED_EVENT:
+    return "connection disconnected";
+  case XIO_SESSION_CONNECTION_REFUSED_EVENT:
+    return "connection refused";
+  case XIO_SESSION_CONNECTION_ERROR_EVENT:
+    return "connection error";
+  case XIO_SESSION_ERROR_EVENT:
+    return "session error";
+  default:
+    return "unknown session event";
+  }
+}
+
+const char *xio_strerror (int errnum)
+{
+  switch (errnum)
+  {
+  case XIO_E_SUCCESS:
+    return "success";
+  case XIO_E_MSG_FLUSHED:
+    return "message flushed";
+  case XIO_E_SESSION_REFUSED:
+    return "session refused";
+  default:
+    return strerror (errnum);
+  }
+}
+
+struct xio_mr *xio_reg_mr (void *addr, size_t length)
+{
+  xio_mr* mr = new xio_mr;
+  mr->addr = addr;
+  mr->length = length;
+  return mr;
+}
+
+int xio_dereg_mr (struct xio_mr **p_mr)
+{
+  delete *p_mr;
+  *p_mr = NULL;
+  return 0;
+}
+
+////////////////////////////////////////////////////////
+///  Mock controls
+////////////////////////////////////////////////////////
+int xio_ace_mock_break (struct xio_connection* conn)
+{
+  if (conn == NULL || conn->closed)
+  {
+    return -1;
+  }
+
+  conn->broken = true;
+  post (conn->ctx, Mock_Event::DISCONNECTED, conn, NULL, 0);
+
+  xio_connection* peer = conn->peer;
+  if (peer && !peer->closed)
+  {
+    peer->broken = true;
+    post (peer->ctx, Mock_Event::DISCONNECTED, peer, NULL, 0);
+  }
+  return 0;
+}
+
+size_t xio_ace_mock_pending (struct xio_context* ctx)
+{
+  ACE_GUARD_RETURN (ACE_Thread_Mutex, guard, ctx->lock, 0);
+  return ctx->events.size ();
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XIO_ACE_MOCK_H
+#define XIO_ACE_MOCK_H
+
+#include <libxio.h>
+
+/**
+ * In-process stand-in for accelio.
+ *
+ * xio_ace_mock.cpp implements the accelio functions the wrappers call,
+ * link it instead of libxio to run servers and clients of one process
+ * without an RDMA or TCP endpoint. Every context registers an eventfd
+ * through its loop ops, exactly as accelio registers its completion
+ * channel, so the events are dispatched by the reactor through the
+ * wrappers' handlers. Messages are copied between connections through
+ * per context queues; the callbacks follow the order accelio uses:
+ *
+ * - xio_connect: on_new_session (first connection of a session) and
+ *   XIO_SESSION_NEW_CONNECTION_EVENT on the server, then
+ *   on_session_established (first connection) and
+ *   XIO_SESSION_CONNECTION_ESTABLISHED_EVENT on the client. A rejected
+ *   session gets XIO_SESSION_REJECT_EVENT and XIO_SESSION_TEARDOWN_EVENT
+ * - xio_send_request: on_msg on the server, xio_send_response: on_msg
+ *   on the client and on_msg_send_complete on the server
+ * - xio_disconnect: outstanding requests fail with XIO_E_MSG_FLUSHED,
+ *   both sides get XIO_SESSION_CONNECTION_CLOSED_EVENT, a session whose
+ *   last connection closed gets XIO_SESSION_TEARDOWN_EVENT
+ *
+ * Servers are bound by URI, any URI string works. Closed sessions and
+ * connections are kept until the last context is closed, so queued
+ * events never refer to freed memory. Contexts may run on different
+ * threads, closing a session while its peer's context is still
+ * delivering to it is not supported.
+ */
+
+/**
+ * Break a connection: both sides get
+ * XIO_SESSION_CONNECTION_DISCONNECTED_EVENT and sends fail until the
+ * application calls xio_disconnect
+ *
+ * @return 0 on success, -1 if the connection is closed
+ */
+int xio_ace_mock_break (struct xio_connection* conn);
+
+/// Number of events queued on a context
+size_t xio_ace_mock_pending (struct xio_context* ctx);
+
+#endif // XIO_ACE_MOCK_H
@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "xio_ace_multicast.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+////////////////////////////////////////////////////////
+///  XIO_Shared_Buffer
+////////////////////////////////////////////////////////
+XIO_Shared_Buffer*
+XIO_Shared_Buffer::create (size_t size)
+{
+  void* data = malloc (size);
+  if (data == NULL)
+  {
+    return NULL;
+  }
+
+  struct xio_mr* mr = xio_reg_mr (data, size);
+  if (mr == NULL)
+  {
+    free (data);
+    return NULL;
+  }
+
+  return new XIO_Shared_Buffer (data, size, mr);
+}
+
+XIO_Shared_Buffer::XIO_Shared_Buffer (void* data, size_t capacity, struct xio_mr* mr)
+: data_ (data)
+, capacity_ (capacity)
+, length_ (0)
+, mr_ (mr)
+, refcount_ (1)
+{
+}
+
+XIO_Shared_Buffer::~XIO_Shared_Buffer ()
+{
+  xio_dereg_mr (&this->mr_);
+  free (this->data_);
+}
+
+XIO_Shared_Buffer*
+XIO_Shared_Buffer::acquire ()
+{
+  ++this->refcount_;
+  return this;
+}
+
+void
+XIO_Shared_Buffer::release ()
+{
+  if (--this->refcount_ == 0)
+  {
+    delete this;
+  }
+}
+
+void*
+XIO_Shared_Buffer::data ()
+{
+  return this->data_;
+}
+
+size_t
+XIO_Shared_Buffer::capacity () const
+{
+  return this->capacity_;
+}
+
+size_t
+XIO_Shared_Buffer::length () const
+{
+  return this->length_;
+}
+
+void
+XIO_Shared_Buffer::length (size_t length)
+{
+  assert (length <= this->capacity_);
+  this->length_ = length;
+}
+
+struct xio_mr*
+XIO_Shared_Buffer::mr ()
+{
+  return this->mr_;
+}
+
+
+////////////////////////////////////////////////////////
+///  XIO_Multicast_Group
+////////////////////////////////////////////////////////
+XIO_Multicast_Group::XIO_Multicast_Group (size_t max_outstanding, size_t max_queued)
+: max_outstanding_ (max_outstanding)
+, max_queued_ (max_queued)
+, dropped_ (0)
+{
+  assert (max_outstanding > 0);
+}
+
+XIO_Multicast_Group::~XIO_Multicast_Group ()
+{
+  for (Destination_Map::iterator it = this->destinations_.begin ();
+       it != this->destinations_.end ();
+       ++it)
+  {
+    // Messages still in flight would reference the destination
+    assert (it->second->in_flight == 0);
+    this->drop_queued (it->second);
+    delete it->second;
+  }
+
+  for (size_t i = 0; i < this->free_sends_.size (); ++i)
+  {
+    delete this->free_sends_[i];
+  }
+}
+
+int
+XIO_Multicast_Group::join (struct xio_connection* conn)
+{
+  if (this->destinations_.find (conn) != this->destinations_.end ())
+  {
+    return -1;
+  }
+
+  Destination* dest = new Destination;
+  dest->conn = conn;
+  dest->in_flight = 0;
+  dest->left = false;
+  this->destinations_[conn] = dest;
+  return 0;
+}
+
+int
+XIO_Multicast_Group::leave (struct xio_connection* conn)
+{
+  Destination_Map::iterator it = this->destinations_.find (conn);
+  if (it == this->destinations_.end ())
+  {
+    return -1;
+  }
+
+  Destination* dest = it->second;
+  this->destinations_.erase (it);
+  this->drop_queued (dest);
+
+  if (dest->in_flight == 0)
+  {
+    delete dest;
+  }
+  else
+  {
+    // Deleted by the last completion
+    dest->left = true;
+  }
+  return 0;
+}
+
+size_t
+XIO_Multicast_Group::publish (XIO_Shared_Buffer* buffer)
+{
+  size_t count = 0;
+  for (Destination_Map::iterator it = this->destinations_.begin ();
+       it != this->destinations_.end ();
+       ++it)
+  {
+    Destination* dest = it->second;
+    if (dest->in_flight < this->max_outstanding_ && dest->queued.empty ())
+    {
+      if (this->send (dest, buffer) == 0)
+      {
+        ++count;
+      }
+      else
+      {
+        ++this->dropped_;
+      }
+      continue;
+    }
+
+    // Window is full - queue, dropping the oldest publication if needed
+    if (dest->queued.size () >= this->max_queued_)
+    {
+      if (dest->queued.empty ())
+      {
+        ++this->dropped_;
+        continue;
+      }
+      dest->queued.front ()->release ();
+      dest->queued.pop_front ();
+      ++this->dropped_;
+    }
+    dest->queued.push_back (buffer->acquire ());
+    ++count;
+  }
+  return count;
+}
+
+bool
+XIO_Multicast_Group::on_msg_send_complete (xio_msg* msg)
+{
+  return this->complete (msg);
+}
+
+bool
+XIO_Multicast_Group::on_msg_error (xio_msg* msg)
+{
+  return this->complete (msg);
+}
+
+size_t
+XIO_Multicast_Group::size () const
+{
+  return this->destinations_.size ();
+}
+
+size_t
+XIO_Multicast_Group::dropped () const
+{
+  return this->dropped_;
+}
+
+int
+XIO_Multicast_Group::send (Destination* dest, XIO_Shared_Buffer* buffer)
+{
+  Send* send = this->alloc_send ();
+  send->dest = dest;
+  send->buffer = buffer->acquire ();
+
+  xio_msg* msg = &send->msg;
+  memset (msg, 0, sizeof (xio_msg));
+  // Tags the message as ours, see complete ()
+  msg->user_context = this;
+  msg->out.data_iovlen = 1;
+  msg->out.data_iov[0].iov_base = buffer->data ();
+  msg->out.data_iov[0].iov_len = buffer->length ();
+  msg->out.data_iov[0].mr = buffer->mr ();
+
+  if (xio_send_msg (dest->conn, msg) != 0)
+  {
+    buffer->release ();
+    this->free_send (send);
+    return -1;
+  }
+
+  ++dest->in_flight;
+  return 0;
+}
+
+bool
+XIO_Multicast_Group::complete (xio_msg* msg)
+{
+  if (msg == NULL || msg->user_context != this)
+  {
+    return false;
+  }
+
+  // msg is the first member of Send
+  Send* send = reinterpret_cast <Send*> (msg);
+  Destination* dest = send->dest;
+  send->buffer->release ();
+  this->free_send (send);
+
+  assert (dest->in_flight > 0);
+  --dest->in_flight;
+
+  if (dest->left)
+  {
+    if (dest->in_flight == 0)
+    {
+      delete dest;
+    }
+    return true;
+  }
+
+  // Refill the window from the queue
+  while (dest->in_flight < this->max_outstanding_ && !dest->queued.empty ())
+  {
+    XIO_Shared_Buffer* buffer = dest->queued.front ();
+    dest->queued.pop_front ();
+    if (this->send (dest, buffer) != 0)
+    {
+      ++this->dropped_;
+    }
+    buffer->release ();
+  }
+  return true;
+}
+
+void
+XIO_Multicast_Group::drop_queued (Destination* dest)
+{
+  while (!dest->queued.empty ())
+  {
+    dest->queued.front ()->release ();
+    dest->queued.pop_front ();
+  }
+}
+
+XIO_Multicast_Group::Send*
+XIO_Multicast_Group::alloc_send ()
+{
+  if (this->free_sends_.empty ())
+  {
+    return new Send;
+  }
+
+  Send* send = this->free_sends_.back ();
+  this->free_sends_.pop_back ();
+  return send;
+}
+
+void
+XIO_Multicast_Group::free_send (Send* send)
+{
+  this->free_sends_.push_back (send);
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XIO_ACE_MULTICAST_H
+#define XIO_ACE_MULTICAST_H
+
+#include <libxio.h>
+#include <ace/Atomic_Op.h>
+#include <ace/Thread_Mutex.h>
+
+#include <deque>
+#include <map>
+#include <vector>
+
+/**
+ * A reference counted, memory registered buffer.
+ *
+ * The same buffer can be attached to any number of outgoing messages.
+ * Every message holds a reference which is dropped when the send
+ * completes, and the buffer is deregistered and freed when the last
+ * reference is released.
+ */
+class XIO_Shared_Buffer
+{
+public:
+  /**
+   * Allocate and register a new buffer
+   *
+   * @param size The capacity of the buffer in bytes
+   *
+   * @return The new buffer with a reference count of 1, or NULL upon
+   *         error.
+   */
+  static XIO_Shared_Buffer* create (size_t size);
+
+  /// Add a reference to the buffer
+  XIO_Shared_Buffer* acquire ();
+
+  /// Drop a reference. The buffer is freed when the count reaches 0
+  void release ();
+
+  /// Accessor to the buffer memory
+  void* data ();
+  /// Accessor to the buffer capacity
+  size_t capacity () const;
+  /// Accessor to the number of valid bytes in the buffer
+  size_t length () const;
+  /// Set the number of valid bytes in the buffer (up to capacity)
+  void length (size_t length);
+  /// Accessor to the memory registration of the buffer
+  struct xio_mr* mr ();
+
+private:
+  XIO_Shared_Buffer (void* data, size_t capacity, struct xio_mr* mr);
+  ~XIO_Shared_Buffer ();
+
+  void* data_;
+  size_t capacity_;
+  size_t length_;
+  struct xio_mr* mr_;
+  ACE_Atomic_Op <ACE_Thread_Mutex, long> refcount_;
+};
+
+
+/**
+ * Sends one shared buffer to a set of connections.
+ *
+ * Each destination has its own window of outstanding messages. When a
+ * destination's window is full new publications are queued for it
+ * (up to max_queued, after which the oldest queued publication is
+ * dropped) so that a slow subscriber never delays the others.
+ *
+ * The group must be used from the thread running the reactor of the
+ * connections' context. The owner has to forward its
+ * on_msg_send_complete and on_msg_error callbacks to the group.
+ */
+class XIO_Multicast_Group
+{
+public:
+  /**
+   * Create an empty group
+   *
+   * @param max_outstanding Maximal number of messages in flight per
+   *                        destination
+   * @param max_queued Maximal number of publications queued per
+   *                   destination while its window is full
+   */
+  XIO_Multicast_Group (size_t max_outstanding, size_t max_queued);
+  virtual ~XIO_Multicast_Group ();
+
+  /**
+   * Add a destination.
+   * Typically called on XIO_SESSION_NEW_CONNECTION_EVENT
+   *
+   * @return 0 on success, -1 if the connection is already a member
+   */
+  int join (struct xio_connection* conn);
+
+  /**
+   * Remove a destination and drop its queued publications.
+   * Typically called on XIO_SESSION_CONNECTION_TEARDOWN_EVENT. Messages
+   * already in flight are still accounted for when they complete.
+   *
+   * @return 0 on success, -1 if the connection is not a member
+   */
+  int leave (struct xio_connection* conn);
+
+  /**
+   * Send a buffer to all destinations.
+   *
+   * The group takes its own references, the caller keeps (and should
+   * release) the reference it holds.
+   *
+   * @param buffer The buffer to send, buffer->length () bytes are sent
+   *
+   * @return The number of destinations the buffer was sent or queued to
+   */
+  size_t publish (XIO_Shared_Buffer* buffer);
+
+  /**
+   * Handle a send completion
+   *
+   * @return true if the message belonged to the group (and was
+   *         recycled), false if it should be handled by the caller
+   */
+  bool on_msg_send_complete (xio_msg* msg);
+
+  /**
+   * Handle a send error
+   *
+   * @return true if the message belonged to the group (and was
+   *         recycled), false if it should be handled by the caller
+   */
+  bool on_msg_error (xio_msg* msg);
+
+  /// Number of destinations
+  size_t size () const;
+  /// Number of publications dropped because a destination's queue was
+  /// full or the send to it failed
+  size_t dropped () const;
+
+private:
+  struct Destination
+  {
+    struct xio_connection* conn;
+    size_t in_flight;
+    bool left;
+    std::deque <XIO_Shared_Buffer*> queued;
+  };
+
+  /// A message in flight, msg must stay the first member
+  struct Send
+  {
+    xio_msg msg;
+    Destination* dest;
+    XIO_Shared_Buffer* buffer;
+  };
+
+  typedef std::map <struct xio_connection*, Destination*> Destination_Map;
+
+  /// Send a buffer to a destination with an open window
+  int send (Destination* dest, XIO_Shared_Buffer* buffer);
+  /// Recycle a completed message and refill the destination's window
+  bool complete (xio_msg* msg);
+  /// Release the queued publications of a destination
+  void drop_queued (Destination* dest);
+
+  Send* alloc_send ();
+  void free_send (Send* send);
+
+  size_t max_outstanding_;
+  size_t max_queued_;
+  size_t dropped_;
+  Destination_Map destinations_;
+  std::vector <Send*> free_sends_;
+};
+
+#endif // XIO_ACE_MULTICAST_H
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Multicast check.
+ *
+ * Link with xio_ace_mock.cpp instead of libxio. An XIO_Server publishes
+ * shared buffers to its client connections over the mock transport
+ * through an XIO_Multicast_Group. The check publishes more buffers than
+ * the destination windows and queues hold and verifies that every
+ * destination receives the first window and the newest queued
+ * publications, and that the publications dropped by a full queue or by
+ * a broken connection are counted.
+ *
+ * Usage: xio_ace_multicast_test
+ */
+
+#include "xio_ace_mock.h"
+#include "xio_ace_session.h"
+#include "xio_ace_multicast.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static int failures = 0;
+
+static void check (bool ok, const char* what)
+{
+  printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok)
+  {
+    ++failures;
+  }
+}
+
+////////////////////////////////////////////////////////
+///  Server
+////////////////////////////////////////////////////////
+class Test_Server : public XIO_Server
+{
+public:
+  static const XIO_Callback_Implementor::Callback cbs =
+    (XIO_Callback_Implementor::Callback) (XIO_Callback_Implementor::XIO_CB_ON_MSG_SEND_COMPLETE |
+                                          XIO_Callback_Implementor::XIO_CB_ON_MSG_ERROR |
+                                          XIO_Callback_Implementor::XIO_CB_ON_SESSION_EVENT);
+
+  Test_Server (size_t max_outstanding, size_t max_queued)
+  : XIO_Server (cbs)
+  , group (max_outstanding, max_queued)
+  {
+  }
+
+  virtual int on_session_event (xio_session* session, xio_session_event_data* data)
+  {
+    switch (data->event)
+    {
+    case XIO_SESSION_NEW_CONNECTION_EVENT:
+      this->group.join (data->conn);
+      break;
+    case XIO_SESSION_CONNECTION_CLOSED_EVENT:
+      this->group.leave (data->conn);
+      break;
+    default:
+      break;
+    }
+    return 0;
+  }
+
+  virtual int on_msg_send_complete (xio_session* session, xio_msg* msg)
+  {
+    this->group.on_msg_send_complete (msg);
+    return 0;
+  }
+
+  virtual int on_msg_error (xio_session* session, xio_status error, xio_msg* msg)
+  {
+    this->group.on_msg_error (msg);
+    return 0;
+  }
+
+  XIO_Multicast_Group group;
+};
+
+////////////////////////////////////////////////////////
+///  Client
+////////////////////////////////////////////////////////
+class Test_Session : public XIO_Reqeust_Session
+{
+public:
+  static const XIO_Callback_Implementor::Callback cbs =
+    (XIO_Callback_Implementor::Callback) (XIO_Callback_Implementor::XIO_CB_ON_MSG |
+                                          XIO_Callback_Implementor::XIO_CB_ON_SESSION_EVENT);
+
+  Test_Session ()
+  : XIO_Reqeust_Session (cbs)
+  {
+  }
+
+  virtual int on_session_event (xio_session* session, xio_session_event_data* data)
+  {
+    switch (data->event)
+    {
+    case XIO_SESSION_CONNECTION_CLOSED_EVENT:
+      {
+        XIO_Connection* connection = reinterpret_cast <XIO_Connection*> (data->conn_user_context);
+        if (connection)
+        {
+          connection->close ();
+        }
+      }
+      break;
+    case XIO_SESSION_TEARDOWN_EVENT:
+      this->close ();
+      break;
+    default:
+      break;
+    }
+    return 0;
+  }
+};
+
+class Test_Connection : public XIO_Connection
+{
+public:
+  /// Record the sequence number of a publication
+  virtual int on_msg (xio_session* session, xio_msg* msg, int more_in_batch)
+  {
+    int seq = -1;
+    if (msg->in.data_iovlen == 1 && msg->in.data_iov[0].iov_len == sizeof (seq))
+    {
+      memcpy (&seq, msg->in.data_iov[0].iov_base, sizeof (seq));
+    }
+    this->received.push_back (seq);
+    xio_release_msg (msg);
+    return 0;
+  }
+
+  std::vector <int> received;
+};
+
+/// Deliver all queued events
+static void settle (ACE_Reactor* reactor, xio_context* ctx)
+{
+  while (xio_ace_mock_pending (ctx) > 0)
+  {
+    reactor->handle_events ();
+  }
+}
+
+static const int PUBLICATIONS = 10;
+
+int main (int argc, char* argv[])
+{
+  ACE_Reactor* reactor = ACE_Reactor::instance ();
+  xio_context* ctx = xio_ace_ctx_open (reactor, 0);
+  if (ctx == NULL)
+  {
+    printf("Failed to open context\n");
+    return -1;
+  }
+
+  // Two messages in flight and three queued per destination
+  Test_Server server (2, 3);
+  server.open (ctx, "mock://multicast", NULL, 0);
+
+  Test_Session session_a;
+  session_a.open ("mock://multicast", 0, 0, NULL, 0);
+  Test_Connection a;
+  a.open (&session_a, ctx, 0);
+  Test_Session session_b;
+  session_b.open ("mock://multicast", 0, 0, NULL, 0);
+  Test_Connection b;
+  b.open (&session_b, ctx, 0);
+  settle (reactor, ctx);
+  check (server.group.size () == 2, "destinations joined");
+
+  for (int seq = 0; seq < PUBLICATIONS; ++seq)
+  {
+    XIO_Shared_Buffer* buffer = XIO_Shared_Buffer::create (sizeof (seq));
+    if (buffer == NULL)
+    {
+      printf("Failed to create a buffer\n");
+      return -1;
+    }
+    memcpy (buffer->data (), &seq, sizeof (seq));
+    buffer->length (sizeof (seq));
+    server.group.publish (buffer);
+    buffer->release ();
+  }
+  check (server.group.dropped () == 10, "oldest queued publications dropped");
+
+  // The queued publications of a broken connection cannot be sent
+  xio_ace_mock_break (b.connection ());
+  settle (reactor, ctx);
+
+  const int expected[] = { 0, 1, 7, 8, 9 };
+  check (a.received == std::vector <int> (expected, expected + 5),
+         "window and newest publications received");
+  check (server.group.dropped () == 13, "publications of a broken connection dropped");
+
+  b.disconnect ();
+  settle (reactor, ctx);
+  check (server.group.size () == 1, "closed destination left");
+
+  a.close ();
+  session_a.close ();
+  settle (reactor, ctx);
+  server.close ();
+  xio_ctx_close (ctx);
+
+  printf("%s\n", failures == 0 ? "PASSED" : "FAILED");
+  return failures == 0 ? 0 : -1;
+}
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "xio_ace_numa.h"
+#include "xio_ace_session.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/// Memory policy of mbind (linux/mempolicy.h), avoids a libnuma dependency
+static const int XIO_ACE_MPOL_PREFERRED = 1;
+
+/// Read a single integer from a sysfs file
+static int read_sysfs_int (const char* path, int* value)
+{
+  FILE* file = fopen (path, "r");
+  if (file == NULL)
+  {
+    return -1;
+  }
+  int retval = fscanf (file, "%d", value) == 1 ? 0 : -1;
+  fclose (file);
+  return retval;
+}
+
+int xio_ace_cpu_numa_node (int cpu)
+{
+  char path[128];
+  snprintf (path, sizeof (path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+  DIR* dir = opendir (path);
+  if (dir == NULL)
+  {
+    return -1;
+  }
+
+  // The cpu directory holds a "node<N>" link to its node
+  int node = -1;
+  struct dirent* entry;
+  while ((entry = readdir (dir)) != NULL)
+  {
+    if (sscanf (entry->d_name, "node%d", &node) == 1)
+    {
+      break;
+    }
+    node = -1;
+  }
+  closedir (dir);
+  return node;
+}
+
+int xio_ace_device_numa_node (const char *device)
+{
+  static const char* const CLASSES[] = { "infiniband", "net" };
+
+  for (size_t i = 0; i < sizeof (CLASSES) / sizeof (CLASSES[0]); ++i)
+  {
+    char path[256];
+    snprintf (path, sizeof (path), "/sys/class/%s/%s/device/numa_node", CLASSES[i], device);
+
+    int node;
+    if (read_sysfs_int (path, &node) == 0)
+    {
+      return node;
+    }
+  }
+  return -1;
+}
+
+int xio_ace_node_cpus (int node, std::vector <int>& cpus)
+{
+  char path[128];
+  snprintf (path, sizeof (path), "/sys/devices/system/node/node%d/cpulist", node);
+
+  FILE* file = fopen (path, "r");
+  if (file == NULL)
+  {
+    return -1;
+  }
+
+  // Format is a list of ranges, e.g. "0-7,16-23"
+  cpus.clear ();
+  int first, last;
+  char sep;
+  while (fscanf (file, "%d", &first) == 1)
+  {
+    last = first;
+    if (fscanf (file, "%c", &sep) == 1 && sep == '-')
+    {
+      if (fscanf (file, "%d", &last) != 1)
+      {
+        break;
+      }
+      if (fscanf (file, "%c", &sep) != 1)
+      {
+        sep = '\n';
+      }
+    }
+    for (int cpu = first; cpu <= last; ++cpu)
+    {
+      cpus.push_back (cpu);
+    }
+    if (sep != ',')
+    {
+      break;
+    }
+  }
+  fclose (file);
+  return 0;
+}
+
+int xio_ace_bind_thread (int cpu)
+{
+  cpu_set_t set;
+  CPU_ZERO (&set);
+  CPU_SET (cpu, &set);
+  return pthread_setaffinity_np (pthread_self (), sizeof (set), &set) == 0 ? 0 : -1;
+}
+
+struct xio_context* xio_ace_ctx_open_on_cpu (ACE_Reactor *reactor,
+                                             int polling_timeout_us,
+                                             int cpu)
+{
+  if (xio_ace_bind_thread (cpu) != 0)
+  {
+    return NULL;
+  }
+  return xio_ace_ctx_open (reactor, polling_timeout_us);
+}
+
+void* xio_ace_numa_alloc (size_t size, int node)
+{
+  void* addr = mmap (NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (addr == MAP_FAILED)
+  {
+    return NULL;
+  }
+
+  xio_ace_numa_bind (addr, size, node);
+  return addr;
+}
+
+void xio_ace_numa_free (void *addr, size_t size)
+{
+  if (addr)
+  {
+    munmap (addr, size);
+  }
+}
+
+int xio_ace_numa_bind (void *addr, size_t size, int node)
+{
+  unsigned long mask[16] = { 0 };
+  const size_t bits = sizeof (mask[0]) * 8;
+  if (node < 0 || (size_t) node >= sizeof (mask) * 8)
+  {
+    return node < 0 ? 0 : -1;
+  }
+
+  // Preferred rather than bound, a full node falls back to others
+  mask[node / bits] |= 1UL << (node % bits);
+  return syscall (SYS_mbind, addr, size, XIO_ACE_MPOL_PREFERRED,
+                  mask, sizeof (mask) * 8, 0) == 0 ? 0 : -1;
+}
+
+
+////////////////////////////////////////////////////////
+///  XIO_Context_Placement
+////////////////////////////////////////////////////////
+XIO_Context_Placement::XIO_Context_Placement ()
+: next_ (0)
+{
+}
+
+XIO_Context_Placement::~XIO_Context_Placement ()
+{
+}
+
+void
+XIO_Context_Placement::add (struct xio_context* ctx, int cpu)
+{
+  Placed_Context placed;
+  placed.ctx = ctx;
+  placed.node = xio_ace_cpu_numa_node (cpu);
+  this->contexts_.push_back (placed);
+}
+
+struct xio_context*
+XIO_Context_Placement::select (int node)
+{
+  size_t count = this->contexts_.size ();
+  if (count == 0)
+  {
+    return NULL;
+  }
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    size_t idx = (this->next_ + i) % count;
+    if (this->contexts_[idx].node == node)
+    {
+      this->next_ = idx + 1;
+      return this->contexts_[idx].ctx;
+    }
+  }
+
+  // No context on the node (or the node is unknown)
+  size_t idx = this->next_ % count;
+  this->next_ = idx + 1;
+  return this->contexts_[idx].ctx;
+}
+
+struct xio_context*
+XIO_Context_Placement::select_near (const char *device)
+{
+  return this->select (xio_ace_device_numa_node (device));
+}
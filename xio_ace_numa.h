@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XIO_ACE_NUMA_H
+#define XIO_ACE_NUMA_H
+
+#include <libxio.h>
+#include <ace/Reactor.h>
+
+#include <vector>
+
+/**
+ * NUMA node of a cpu.
+ *
+ * @param cpu The cpu number
+ *
+ * @return The node, or -1 if unknown
+ */
+int xio_ace_cpu_numa_node (int cpu);
+
+/**
+ * NUMA node a device is attached to.
+ *
+ * @param device An RDMA device (e.g. "mlx4_0") or a network interface
+ *               (e.g. "ib0")
+ *
+ * @return The node, or -1 if unknown
+ */
+int xio_ace_device_numa_node (const char *device);
+
+/**
+ * The cpus of a NUMA node.
+ *
+ * @param node The node
+ * @param cpus Filled with the cpu numbers of the node
+ *
+ * @return 0 on success, -1 upon error
+ */
+int xio_ace_node_cpus (int node, std::vector <int>& cpus);
+
+/**
+ * Pin the calling thread to a cpu.
+ *
+ * @return 0 on success, -1 upon error
+ */
+int xio_ace_bind_thread (int cpu);
+
+/**
+ * Pin the calling thread to a cpu and create an xio context on it.
+ *
+ * Memory first touched by the thread afterwards (the event handlers
+ * created when accelio registers its fds, pools opened on this thread)
+ * is allocated on the cpu's node. The reactor should be created on the
+ * same thread, after pinning, for its handler table to be local too.
+ *
+ * @param reactor The reactor use for events
+ * @param polling_timeout_us polling timeout in microsecs - 0 ignore
+ * @param cpu The cpu to pin the calling thread to
+ *
+ * @note The reactor's run_event_loop method should be called on the
+ *       same thread where this context is created
+ * @return xio context handle, or NULL upon error.
+ */
+struct xio_context* xio_ace_ctx_open_on_cpu (ACE_Reactor *reactor,
+                                             int polling_timeout_us,
+                                             int cpu);
+
+/**
+ * Allocate page aligned memory preferably placed on a NUMA node.
+ *
+ * @param size Size in bytes
+ * @param node The node, -1 for the default policy
+ *
+ * @return The memory, or NULL upon error. Free with xio_ace_numa_free
+ */
+void* xio_ace_numa_alloc (size_t size, int node);
+
+/// Free memory allocated by xio_ace_numa_alloc
+void xio_ace_numa_free (void *addr, size_t size);
+
+/**
+ * Set the preferred NUMA node of a mapping before it is touched.
+ *
+ * @param addr Page aligned start of the mapping
+ * @param size Size in bytes
+ * @param node The node, -1 does nothing
+ *
+ * @return 0 on success, -1 upon error
+ */
+int xio_ace_numa_bind (void *addr, size_t size, int node);
+
+
+/**
+ * Steers sessions to the context closest to a device.
+ *
+ * Contexts are registered with the cpu they were opened on; select
+ * returns the contexts of a node round robin, falling back to all
+ * contexts when the node has none.
+ */
+class XIO_Context_Placement
+{
+public:
+  XIO_Context_Placement ();
+  virtual ~XIO_Context_Placement ();
+
+  /**
+   * Register a context
+   *
+   * @param ctx Context handle
+   * @param cpu The cpu the context's thread is pinned to
+   */
+  void add (struct xio_context* ctx, int cpu);
+
+  /**
+   * Pick a context on a node
+   *
+   * @return A context, or NULL if no context was registered
+   */
+  struct xio_context* select (int node);
+
+  /// Pick a context on the node of a device (see xio_ace_device_numa_node)
+  struct xio_context* select_near (const char *device);
+
+private:
+  struct Placed_Context
+  {
+    struct xio_context* ctx;
+    int node;
+  };
+
+  std::vector <Placed_Context> contexts_;
+  size_t next_;
+};
+
+#endif // XIO_ACE_NUMA_H
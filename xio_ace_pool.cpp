@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "xio_ace_pool.h"
+#include "xio_ace_arena.h"
+#include "xio_ace_numa.h"
+
+#include <assert.h>
+#include <string.h>
+
+////////////////////////////////////////////////////////
+///  XIO_Buffer_Pool
+////////////////////////////////////////////////////////
+XIO_Buffer_Pool::XIO_Buffer_Pool ()
+: region_ (NULL)
+, region_size_ (0)
+, buffer_size_ (0)
+, mr_ (NULL)
+, arena_ (NULL)
+{
+}
+
+XIO_Buffer_Pool::~XIO_Buffer_Pool ()
+{
+  if (this->region_)
+  {
+    this->close ();
+  }
+}
+
+int
+XIO_Buffer_Pool::open (size_t buffer_size, size_t count, int numa_node)
+{
+  if (this->region_ || buffer_size == 0 || count == 0)
+  {
+    return -1;
+  }
+
+  size_t region_size = buffer_size * count;
+  void* region = xio_ace_numa_alloc (region_size, numa_node);
+  if (region == NULL)
+  {
+    return -1;
+  }
+
+  // Fault the pages in on this thread before registering
+  memset (region, 0, region_size);
+
+  this->mr_ = xio_reg_mr (region, region_size);
+  if (this->mr_ == NULL)
+  {
+    xio_ace_numa_free (region, region_size);
+    return -1;
+  }
+
+  this->region_ = reinterpret_cast <char*> (region);
+  this->region_size_ = region_size;
+  this->buffer_size_ = buffer_size;
+  this->fill (count);
+  return 0;
+}
+
+int
+XIO_Buffer_Pool::open (XIO_Arena* arena, size_t buffer_size, size_t count)
+{
+  if (this->region_ || buffer_size == 0 || count == 0)
+  {
+    return -1;
+  }
+
+  void* region = arena->allocate (buffer_size * count);
+  if (region == NULL)
+  {
+    return -1;
+  }
+
+  this->region_ = reinterpret_cast <char*> (region);
+  this->region_size_ = buffer_size * count;
+  this->buffer_size_ = buffer_size;
+  this->mr_ = arena->mr ();
+  this->arena_ = arena;
+  this->fill (count);
+  return 0;
+}
+
+int
+XIO_Buffer_Pool::close ()
+{
+  if (this->region_ == NULL)
+  {
+    return 0;
+  }
+
+  int retval = 0;
+  if (this->arena_ == NULL)
+  {
+    retval = xio_dereg_mr (&this->mr_);
+    xio_ace_numa_free (this->region_, this->region_size_);
+  }
+  this->arena_ = NULL;
+  this->region_ = NULL;
+  this->region_size_ = 0;
+  this->mr_ = NULL;
+  this->free_.clear ();
+  return retval;
+}
+
+void*
+XIO_Buffer_Pool::get ()
+{
+  if (this->free_.empty ())
+  {
+    return NULL;
+  }
+
+  void* buffer = this->free_.back ();
+  this->free_.pop_back ();
+  return buffer;
+}
+
+void
+XIO_Buffer_Pool::put (void* buffer)
+{
+  assert (reinterpret_cast <char*> (buffer) >= this->region_ &&
+          reinterpret_cast <char*> (buffer) < this->region_ + this->region_size_);
+  this->free_.push_back (buffer);
+}
+
+void
+XIO_Buffer_Pool::attach (struct xio_iovec_ex& iov, void* buffer, size_t len)
+{
+  assert (len <= this->buffer_size_);
+  iov.iov_base = buffer;
+  iov.iov_len = len;
+  iov.mr = this->mr_;
+}
+
+struct xio_mr*
+XIO_Buffer_Pool::mr ()
+{
+  return this->mr_;
+}
+
+size_t
+XIO_Buffer_Pool::buffer_size () const
+{
+  return this->buffer_size_;
+}
+
+size_t
+XIO_Buffer_Pool::available () const
+{
+  return this->free_.size ();
+}
+
+void
+XIO_Buffer_Pool::fill (size_t count)
+{
+  this->free_.reserve (count);
+  for (size_t i = count; i > 0; --i)
+  {
+    this->free_.push_back (this->region_ + (i - 1) * this->buffer_size_);
+  }
+}
+
+
+////////////////////////////////////////////////////////
+///  XIO_Msg_Pool
+////////////////////////////////////////////////////////
+XIO_Msg_Pool::XIO_Msg_Pool ()
+: msgs_ (NULL)
+, count_ (0)
+, arena_ (NULL)
+{
+}
+
+XIO_Msg_Pool::~XIO_Msg_Pool ()
+{
+  if (this->msgs_)
+  {
+    this->close ();
+  }
+}
+
+int
+XIO_Msg_Pool::open (size_t count, int numa_node)
+{
+  if (this->msgs_ || count == 0)
+  {
+    return -1;
+  }
+
+  this->msgs_ = reinterpret_cast <xio_msg*> (xio_ace_numa_alloc (count * sizeof (xio_msg), numa_node));
+  if (this->msgs_ == NULL)
+  {
+    return -1;
+  }
+
+  // Fault the pages in on this thread, as the buffer pool does
+  memset (this->msgs_, 0, count * sizeof (xio_msg));
+  this->count_ = count;
+  this->fill (count);
+  return 0;
+}
+
+int
+XIO_Msg_Pool::open (XIO_Arena* arena, size_t count)
+{
+  if (this->msgs_ || count == 0)
+  {
+    return -1;
+  }
+
+  this->msgs_ = reinterpret_cast <xio_msg*> (arena->allocate (count * sizeof (xio_msg)));
+  if (this->msgs_ == NULL)
+  {
+    return -1;
+  }
+  this->count_ = count;
+  this->arena_ = arena;
+  this->fill (count);
+  return 0;
+}
+
+int
+XIO_Msg_Pool::close ()
+{
+  if (this->arena_ == NULL)
+  {
+    xio_ace_numa_free (this->msgs_, this->count_ * sizeof (xio_msg));
+  }
+  this->arena_ = NULL;
+  this->msgs_ = NULL;
+  this->count_ = 0;
+  this->free_.clear ();
+  return 0;
+}
+
+xio_msg*
+XIO_Msg_Pool::get ()
+{
+  if (this->free_.empty ())
+  {
+    return NULL;
+  }
+
+  xio_msg* msg = this->free_.back ();
+  this->free_.pop_back ();
+  memset (msg, 0, sizeof (xio_msg));
+  return msg;
+}
+
+void
+XIO_Msg_Pool::put (xio_msg* msg)
+{
+  this->free_.push_back (msg);
+}
+
+size_t
+XIO_Msg_Pool::available () const
+{
+  return this->free_.size ();
+}
+
+void
+XIO_Msg_Pool::fill (size_t count)
+{
+  this->free_.reserve (count);
+  for (size_t i = count; i > 0; --i)
+  {
+    this->free_.push_back (&this->msgs_[i - 1]);
+  }
+}
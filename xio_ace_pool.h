@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XIO_ACE_POOL_H
+#define XIO_ACE_POOL_H
+
+#include <libxio.h>
+
+#include <vector>
+
+class XIO_Arena;
+
+/**
+ * A pool of fixed size buffers carved from one registered region.
+ *
+ * The whole region is registered once when the pool is opened (or is
+ * carved from an already registered XIO_Arena) and touched by the
+ * opening thread, so neither registration nor page faults are paid on
+ * the data path. A pool is not thread safe, it is
+ * meant to be used by the thread running its context.
+ */
+class XIO_Buffer_Pool
+{
+public:
+  XIO_Buffer_Pool ();
+  virtual ~XIO_Buffer_Pool ();
+
+  /**
+   * Allocate and register the buffers
+   *
+   * @param buffer_size Size of every buffer in bytes
+   * @param count Number of buffers
+   * @param numa_node Node to place the buffers on, -1 for the node of
+   *                  the opening thread
+   *
+   * @return 0 on success, -1 upon error
+   */
+  int open (size_t buffer_size, size_t count, int numa_node = -1);
+
+  /**
+   * Carve the buffers from an arena, using its registration
+   *
+   * @param arena The arena, must outlive the pool
+   * @param buffer_size Size of every buffer in bytes
+   * @param count Number of buffers
+   *
+   * @return 0 on success, -1 if the arena is full
+   */
+  int open (XIO_Arena* arena, size_t buffer_size, size_t count);
+
+  /// Deregister and free the buffers
+  int close ();
+
+  /// Get a buffer, NULL if the pool is exhausted
+  void* get ();
+  /// Return a buffer to the pool
+  void put (void* buffer);
+
+  /**
+   * Point an iovec at a buffer of the pool
+   *
+   * @param iov The iovec to fill
+   * @param buffer A buffer returned by get
+   * @param len Number of valid bytes in the buffer
+   */
+  void attach (struct xio_iovec_ex& iov, void* buffer, size_t len);
+
+  /// Accessor to the memory registration covering all buffers
+  struct xio_mr* mr ();
+  /// Accessor to the size of every buffer
+  size_t buffer_size () const;
+  /// Number of buffers currently available
+  size_t available () const;
+
+private:
+  /// Build the free list over the region
+  void fill (size_t count);
+
+  char* region_;
+  size_t region_size_;
+  size_t buffer_size_;
+  struct xio_mr* mr_;
+  /// The arena the region was carved from, NULL if the pool owns it
+  XIO_Arena* arena_;
+  std::vector <void*> free_;
+};
+
+
+/**
+ * A pool of preallocated xio_msg structures.
+ * Not thread safe, like XIO_Buffer_Pool.
+ */
+class XIO_Msg_Pool
+{
+public:
+  XIO_Msg_Pool ();
+  virtual ~XIO_Msg_Pool ();
+
+  /**
+   * Allocate the messages
+   *
+   * @param count Number of messages
+   * @param numa_node Node to place the messages on, -1 for the node of
+   *                  the opening thread
+   *
+   * @return 0 on success, -1 upon error
+   */
+  int open (size_t count, int numa_node = -1);
+
+  /**
+   * Carve the messages from an arena
+   *
+   * @param arena The arena, must outlive the pool
+   * @param count Number of messages
+   *
+   * @return 0 on success, -1 if the arena is full
+   */
+  int open (XIO_Arena* arena, size_t count);
+
+  /// Free the messages
+  int close ();
+
+  /// Get a zeroed message, NULL if the pool is exhausted
+  xio_msg* get ();
+  /// Return a message to the pool
+  void put (xio_msg* msg);
+
+  /// Number of messages currently available
+  size_t available () const;
+
+private:
+  /// Build the free list over the messages
+  void fill (size_t count);
+
+  xio_msg* msgs_;
+  size_t count_;
+  /// The arena the messages were carved from, NULL if the pool owns them
+  XIO_Arena* arena_;
+  std::vector <xio_msg*> free_;
+};
+
+#endif // XIO_ACE_POOL_H
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "xio_ace_priority.h"
+
+////////////////////////////////////////////////////////
+///  XIO_Priority_Scheduler
+////////////////////////////////////////////////////////
+XIO_Priority_Scheduler::XIO_Priority_Scheduler (size_t window)
+: window_ (window)
+{
+}
+
+XIO_Priority_Scheduler::~XIO_Priority_Scheduler ()
+{
+}
+
+int
+XIO_Priority_Scheduler::add_lane (XIO_Connection* conn, unsigned int weight)
+{
+  Lane lane;
+  lane.conn = conn;
+  lane.weight = weight > 0 ? weight : 1;
+  lane.current = 0;
+  this->lanes_.push_back (lane);
+  return static_cast <int> (this->lanes_.size () - 1);
+}
+
+int
+XIO_Priority_Scheduler::send_request (int lane, xio_msg* msg, bool idempotent)
+{
+  if (lane < 0 || static_cast <size_t> (lane) >= this->lanes_.size ())
+  {
+    return -1;
+  }
+
+  Queued_Request request = { msg, idempotent };
+  if ((this->window_ == 0 || this->in_flight_.size () < this->window_) &&
+      this->lanes_[lane].queue.empty ())
+  {
+    return this->send (lane, request);
+  }
+
+  this->lanes_[lane].queue.push_back (request);
+  return 0;
+}
+
+int
+XIO_Priority_Scheduler::release_response (xio_msg* rsp)
+{
+  std::map <xio_msg*, int>::iterator it = this->in_flight_.find (rsp->request);
+  if (it == this->in_flight_.end ())
+  {
+    return xio_release_response (rsp);
+  }
+
+  XIO_Connection* conn = this->lanes_[it->second].conn;
+  this->in_flight_.erase (it);
+  int retval = conn->release_response (rsp);
+  this->drain ();
+  return retval;
+}
+
+void
+XIO_Priority_Scheduler::request_failed (xio_msg* msg)
+{
+  if (this->in_flight_.erase (msg) > 0)
+  {
+    this->drain ();
+  }
+}
+
+size_t
+XIO_Priority_Scheduler::queued (int lane) const
+{
+  return this->lanes_[lane].queue.size ();
+}
+
+size_t
+XIO_Priority_Scheduler::outstanding () const
+{
+  return this->in_flight_.size ();
+}
+
+void
+XIO_Priority_Scheduler::drain ()
+{
+  while (this->window_ == 0 || this->in_flight_.size () < this->window_)
+  {
+    int lane = this->next_lane ();
+    if (lane < 0)
+    {
+      return;
+    }
+
+    Queued_Request request = this->lanes_[lane].queue.front ();
+    this->lanes_[lane].queue.pop_front ();
+    if (this->send (lane, request) != 0)
+    {
+      this->lanes_[lane].conn->fail_request (request.msg);
+    }
+  }
+}
+
+int
+XIO_Priority_Scheduler::next_lane ()
+{
+  // Smooth weighted round robin over the lanes with queued requests
+  int best = -1;
+  int total = 0;
+  for (size_t i = 0; i < this->lanes_.size (); ++i)
+  {
+    Lane& lane = this->lanes_[i];
+    if (lane.queue.empty ())
+    {
+      continue;
+    }
+    lane.current += lane.weight;
+    total += lane.weight;
+    if (best < 0 || lane.current > this->lanes_[best].current)
+    {
+      best = static_cast <int> (i);
+    }
+  }
+
+  if (best >= 0)
+  {
+    this->lanes_[best].current -= total;
+  }
+  return best;
+}
+
+int
+XIO_Priority_Scheduler::send (int lane, const Queued_Request& request)
+{
+  int retval = this->lanes_[lane].conn->send_request (request.msg, request.idempotent);
+  if (retval == 0)
+  {
+    this->in_flight_[request.msg] = lane;
+  }
+  return retval;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XIO_ACE_PRIORITY_H
+#define XIO_ACE_PRIORITY_H
+
+#include "xio_ace_session.h"
+
+#include <deque>
+#include <map>
+#include <vector>
+
+/**
+ * Client side priority lanes.
+ *
+ * Every lane sends on a connection of a session. Lanes may each get a
+ * dedicated connection, so bulk traffic never queues in front of
+ * latency critical requests, or share connections. The number of
+ * requests outstanding over all lanes is bounded by a window; requests
+ * beyond it are queued per lane and sent by smooth weighted round
+ * robin, so a lane with weight 8 gets 8 sends for every send of a lane
+ * with weight 1 while both have queued requests.
+ *
+ * Responses must be released through the scheduler, it is not thread
+ * safe and must be used from the thread running the reactor of the
+ * connections' context.
+ */
+class XIO_Priority_Scheduler
+{
+public:
+  /**
+   * Create a scheduler
+   *
+   * @param window Maximal number of outstanding requests over all lanes
+   *               (0 means unlimited)
+   */
+  XIO_Priority_Scheduler (size_t window);
+  virtual ~XIO_Priority_Scheduler ();
+
+  /**
+   * Add a lane
+   *
+   * @param conn The connection the lane sends on
+   * @param weight Share of the window when lanes compete (at least 1)
+   *
+   * @return The lane id
+   */
+  int add_lane (XIO_Connection* conn, unsigned int weight);
+
+  /**
+   * Send a request on a lane, or queue it if the window is full
+   *
+   * @param lane The lane id
+   * @param msg The request, must stay valid until its response is
+   *            released
+   * @param idempotent Whether the request may be replayed after a
+   *                   reconnect
+   *
+   * @return 0 on success, -1 upon error
+   */
+  int send_request (int lane, xio_msg* msg, bool idempotent);
+
+  /// Release a response and send queued requests
+  int release_response (xio_msg* rsp);
+
+  /// Forget a failed request and send queued requests
+  void request_failed (xio_msg* msg);
+
+  /// Number of requests queued on a lane
+  size_t queued (int lane) const;
+  /// Number of outstanding requests
+  size_t outstanding () const;
+
+private:
+  struct Queued_Request
+  {
+    xio_msg* msg;
+    bool idempotent;
+  };
+
+  struct Lane
+  {
+    XIO_Connection* conn;
+    int weight;
+    int current;
+    std::deque <Queued_Request> queue;
+  };
+
+  /// Send queued requests while the window allows
+  void drain ();
+  /// Pick the next lane by smooth weighted round robin
+  int next_lane ();
+  /// Send a request now
+  int send (int lane, const Queued_Request& request);
+
+  size_t window_;
+  std::vector <Lane> lanes_;
+  /// Lane of every outstanding request
+  std::map <xio_msg*, int> in_flight_;
+};
+
+#endif // XIO_ACE_PRIORITY_H
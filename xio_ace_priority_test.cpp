@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Priority check.
+ *
+ * Link with xio_ace_mock.cpp instead of libxio. A prioritized
+ * XIO_Server receives requests of a high and a low priority session
+ * over the mock transport and the check verifies that the high priority
+ * requests are dispatched first. A client XIO_Priority_Scheduler with a
+ * window of one request then sends over a heavy and a light lane and
+ * the check verifies that the queued requests are sent in the order of
+ * the lane weights.
+ *
+ * Usage: xio_ace_priority_test
+ */
+
+#include "xio_ace_mock.h"
+#include "xio_ace_session.h"
+#include "xio_ace_priority.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <list>
+#include <string>
+
+static int failures = 0;
+
+static void check (bool ok, const char* what)
+{
+  printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok)
+  {
+    ++failures;
+  }
+}
+
+////////////////////////////////////////////////////////
+///  Server
+////////////////////////////////////////////////////////
+class Test_Server : public XIO_Server
+{
+public:
+  static const XIO_Callback_Implementor::Callback cbs =
+    (XIO_Callback_Implementor::Callback) (XIO_Callback_Implementor::XIO_CB_ON_MSG |
+                                          XIO_Callback_Implementor::XIO_CB_ON_MSG_SEND_COMPLETE |
+                                          XIO_Callback_Implementor::XIO_CB_ON_NEW_SESSION);
+
+  Test_Server ()
+  : XIO_Server (cbs)
+  , echo (false)
+  {
+  }
+
+  /// The session priority is sent by the client: "high" or "low"
+  virtual int on_new_session (xio_session* session, xio_new_session_req* req)
+  {
+    if (req->user_context_len == 4 && memcmp (req->user_context, "high", 4) == 0)
+    {
+      this->session_priority (session, 1);
+    }
+    else if (req->user_context_len == 3 && memcmp (req->user_context, "low", 3) == 0)
+    {
+      this->session_priority (session, -1);
+    }
+    return xio_accept (session, NULL, 0, NULL, 0);
+  }
+
+  /// Record the key of every request, hold it unless echoing
+  virtual int on_msg (xio_session* session, xio_msg* msg, int more_in_batch)
+  {
+    this->order.append (reinterpret_cast <const char*> (msg->in.header.iov_base),
+                        msg->in.header.iov_len);
+    this->held.push_back (msg);
+    if (this->echo)
+    {
+      this->answer ();
+    }
+    return 0;
+  }
+
+  virtual int on_msg_send_complete (xio_session* session, xio_msg* msg)
+  {
+    delete msg;
+    return 0;
+  }
+
+  /// Answer the held requests, echoing their header
+  void answer ()
+  {
+    while (!this->held.empty ())
+    {
+      xio_msg* req = this->held.front ();
+      this->held.pop_front ();
+
+      xio_msg* rsp = new xio_msg;
+      memset (rsp, 0, sizeof (xio_msg));
+      rsp->request = req;
+      rsp->out.header = req->in.header;
+      xio_send_response (rsp);
+    }
+  }
+
+  bool echo;
+  /// Keys of the received requests in dispatch order
+  std::string order;
+  std::deque <xio_msg*> held;
+};
+
+////////////////////////////////////////////////////////
+///  Client
+////////////////////////////////////////////////////////
+class Test_Session : public XIO_Reqeust_Session
+{
+public:
+  static const XIO_Callback_Implementor::Callback cbs =
+    (XIO_Callback_Implementor::Callback) (XIO_Callback_Implementor::XIO_CB_ON_MSG |
+                                          XIO_Callback_Implementor::XIO_CB_ON_SESSION_EVENT);
+
+  Test_Session ()
+  : XIO_Reqeust_Session (cbs)
+  {
+  }
+
+  virtual int on_session_event (xio_session* session, xio_session_event_data* data)
+  {
+    if (data->event == XIO_SESSION_TEARDOWN_EVENT)
+    {
+      this->close ();
+    }
+    return 0;
+  }
+};
+
+class Test_Connection : public XIO_Connection
+{
+public:
+  Test_Connection ()
+  : scheduler (NULL)
+  , received (0)
+  {
+  }
+
+  /// Create a request whose header is the key
+  xio_msg* request (const char* key)
+  {
+    this->reqs_.push_back (xio_msg ());
+    xio_msg* req = &this->reqs_.back ();
+    memset (req, 0, sizeof (xio_msg));
+    req->out.header.iov_base = const_cast <char*> (key);
+    req->out.header.iov_len = strlen (key);
+    return req;
+  }
+
+  virtual int on_msg (xio_session* session, xio_msg* rsp, int more_in_batch)
+  {
+    ++this->received;
+    if (this->scheduler)
+    {
+      return this->scheduler->release_response (rsp);
+    }
+    return this->release_response (rsp);
+  }
+
+  /// Responses are released through it when set
+  XIO_Priority_Scheduler* scheduler;
+  int received;
+
+private:
+  /// Requests stay valid until the connection goes away
+  std::list <xio_msg> reqs_;
+};
+
+/// Deliver all queued events
+static void settle (ACE_Reactor* reactor, xio_context* ctx)
+{
+  while (xio_ace_mock_pending (ctx) > 0)
+  {
+    reactor->handle_events ();
+  }
+}
+
+static const int REQUESTS = 8;
+
+int main (int argc, char* argv[])
+{
+  ACE_Reactor* reactor = ACE_Reactor::instance ();
+  xio_context* ctx = xio_ace_ctx_open (reactor, 0);
+  if (ctx == NULL)
+  {
+    printf("Failed to open context\n");
+    return -1;
+  }
+
+  Test_Server server;
+  server.prioritize (reactor, 2);
+  server.open (ctx, "mock://priority", NULL, 0);
+
+  char high_name[] = "high";
+  Test_Session high_session;
+  high_session.open ("mock://priority", 0, 0, high_name, 4);
+  Test_Connection high;
+  high.open (&high_session, ctx, 0);
+  char low_name[] = "low";
+  Test_Session low_session;
+  low_session.open ("mock://priority", 0, 0, low_name, 3);
+  Test_Connection low;
+  low.open (&low_session, ctx, 0);
+  settle (reactor, ctx);
+
+  // The low priority requests are received first but dispatched last
+  for (int i = 0; i < REQUESTS; ++i)
+  {
+    low.send_request (low.request ("l"), false);
+  }
+  for (int i = 0; i < REQUESTS; ++i)
+  {
+    high.send_request (high.request ("h"), false);
+  }
+  settle (reactor, ctx);
+  // The low priority budget is spent one notification at a time
+  while (server.load ().deferred > 0)
+  {
+    reactor->handle_events ();
+  }
+  check (server.order.size () == 2 * REQUESTS, "all requests dispatched");
+  check (server.order.substr (0, REQUESTS) == std::string (REQUESTS, 'h'),
+         "high priority requests dispatched first");
+  check (server.load ().deferred == 0, "no request left deferred");
+
+  server.answer ();
+  settle (reactor, ctx);
+  check (high.received == REQUESTS && low.received == REQUESTS, "requests answered");
+
+  // Queued requests are sent by lane weight, three heavy for one light
+  Test_Session lane_session;
+  lane_session.open ("mock://priority", 0, 0, NULL, 0);
+  Test_Connection heavy;
+  heavy.open (&lane_session, ctx, 0);
+  Test_Connection light;
+  light.open (&lane_session, ctx, 0);
+  settle (reactor, ctx);
+
+  XIO_Priority_Scheduler scheduler (1);
+  int heavy_lane = scheduler.add_lane (&heavy, 3);
+  int light_lane = scheduler.add_lane (&light, 1);
+  heavy.scheduler = &scheduler;
+  light.scheduler = &scheduler;
+
+  server.order.clear ();
+  server.echo = true;
+  for (int i = 0; i < 4; ++i)
+  {
+    scheduler.send_request (heavy_lane, heavy.request ("H"), false);
+  }
+  for (int i = 0; i < 4; ++i)
+  {
+    scheduler.send_request (light_lane, light.request ("L"), false);
+  }
+  check (scheduler.outstanding () == 1 && scheduler.queued (heavy_lane) == 3 &&
+         scheduler.queued (light_lane) == 4, "requests above the window queued");
+  settle (reactor, ctx);
+  check (server.order == "HHHLHLLL", "queued requests sent by lane weight");
+  check (scheduler.outstanding () == 0 && heavy.received == 4 && light.received == 4,
+         "lane requests answered");
+
+  high.close ();
+  high_session.close ();
+  low.close ();
+  low_session.close ();
+  heavy.close ();
+  light.close ();
+  lane_session.close ();
+  settle (reactor, ctx);
+  server.close ();
+  xio_ctx_close (ctx);
+
+  printf("%s\n", failures == 0 ? "PASSED" : "FAILED");
+  return failures == 0 ? 0 : -1;
+}
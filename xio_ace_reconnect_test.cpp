@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Reconnect check.
+ *
+ * Link with xio_ace_mock.cpp instead of libxio. A client session with
+ * reconnect enabled sends requests to an XIO_Server over the mock
+ * transport, the server holds them until the check answers them. The
+ * check breaks the connection and verifies that it is reconnected, that
+ * the idempotent requests are replayed and answered and that the other
+ * ones fail with XIO_E_MSG_FLUSHED. A connection disconnected on purpose
+ * fails its requests and is not reconnected.
+ *
+ * Usage: xio_ace_reconnect_test
+ */
+
+#include "xio_ace_mock.h"
+#include "xio_ace_session.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <list>
+#include <string>
+
+static int failures = 0;
+
+static void check (bool ok, const char* what)
+{
+  printf("%-50s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok)
+  {
+    ++failures;
+  }
+}
+
+////////////////////////////////////////////////////////
+///  Server
+////////////////////////////////////////////////////////
+class Test_Server : public XIO_Server
+{
+public:
+  static const XIO_Callback_Implementor::Callback cbs =
+    (XIO_Callback_Implementor::Callback) (XIO_Callback_Implementor::XIO_CB_ON_MSG |
+                                          XIO_Callback_Implementor::XIO_CB_ON_MSG_SEND_COMPLETE |
+                                          XIO_Callback_Implementor::XIO_CB_ON_SESSION_EVENT);
+
+  Test_Server ()
+  : XIO_Server (cbs)
+  {
+  }
+
+  virtual int on_msg (xio_session* session, xio_msg* msg, int more_in_batch)
+  {
+    Held held = { session, msg };
+    this->held.push_back (held);
+    return 0;
+  }
+
+  virtual int on_msg_send_complete (xio_session* session, xio_msg* msg)
+  {
+    delete msg;
+    return 0;
+  }
+
+  virtual int on_session_event (xio_session* session, xio_session_event_data* data)
+  {
+    if (data->event == XIO_SESSION_TEARDOWN_EVENT)
+    {
+      for (std::deque <Held>::iterator it = this->held.begin (); it != this->held.end (); )
+      {
+        it = it->session == session ? this->held.erase (it) : it + 1;
+      }
+    }
+    return 0;
+  }
+
+  /// Answer the held requests, echoing their header
+  void answer ()
+  {
+    while (!this->held.empty ())
+    {
+      Held held = this->held.front ();
+      this->held.pop_front ();
+
+      xio_msg* rsp = new xio_msg;
+      memset (rsp, 0, sizeof (xio_msg));
+      rsp->request = held.msg;
+      rsp->out.header = held.msg->in.header;
+      xio_send_response (rsp);
+    }
+  }
+
+  struct Held
+  {
+    xio_session* session;
+    xio_msg* msg;
+  };
+
+  std::deque <Held> held;
+};
+
+////////////////////////////////////////////////////////
+///  Client
+////////////////////////////////////////////////////////
+class Test_Session : public XIO_Reqeust_Session
+{
+public:
+  static const XIO_Callback_Implementor::Callback cbs =
+    (XIO_Callback_Implementor::Callback) (XIO_Callback_Implementor::XIO_CB_ON_MSG |
+                                          XIO_Callback_Implementor::XIO_CB_ON_MSG_ERROR |
+                                          XIO_Callback_Implementor::XIO_CB_ON_SESSION_EVENT);
+
+  Test_Session ()
+  : XIO_Reqeust_Session (cbs)
+  , torn_down (false)
+  {
+  }
+
+  virtual int on_session_event (xio_session* session, xio_session_event_data* data)
+  {
+    switch (data->event)
+    {
+    case XIO_SESSION_CONNECTION_CLOSED_EVENT:
+      {
+        XIO_Connection* connection = reinterpret_cast <XIO_Connection*> (data->conn_user_context);
+        if (connection)
+        {
+          connection->close ();
+        }
+      }
+      break;
+    case XIO_SESSION_TEARDOWN_EVENT:
+      this->close ();
+      this->torn_down = true;
+      break;
+    default:
+      break;
+    }
+    return 0;
+  }
+
+  bool torn_down;
+};
+
+class Test_Connection : public XIO_Connection
+{
+public:
+  Test_Connection ()
+  : received (0)
+  , mismatched (0)
+  , flushed (0)
+  {
+  }
+
+  /// Send a request whose header is the key
+  void send (const char* key, bool idempotent)
+  {
+    this->reqs_.push_back (xio_msg ());
+    xio_msg* req = &this->reqs_.back ();
+    memset (req, 0, sizeof (xio_msg));
+    req->out.header.iov_base = const_cast <char*> (key);
+    req->out.header.iov_len = strlen (key);
+    this->send_request (req, idempotent);
+  }
+
+  virtual int on_msg (xio_session* session, xio_msg* rsp, int more_in_batch)
+  {
+    const xio_iovec& sent = rsp->request->out.header;
+    if (rsp->in.header.iov_len != sent.iov_len ||
+        memcmp (rsp->in.header.iov_base, sent.iov_base, sent.iov_len) != 0)
+    {
+      ++this->mismatched;
+    }
+    ++this->received;
+    this->release_response (rsp);
+    return 0;
+  }
+
+  virtual int on_msg_error (xio_session* session, xio_status error, xio_msg* msg)
+  {
+    if (error == XIO_E_MSG_FLUSHED)
+    {
+      ++this->flushed;
+    }
+    this->failed.append (reinterpret_cast <const char*> (msg->out.header.iov_base),
+                         msg->out.header.iov_len);
+    this->failed += ' ';
+    return 0;
+  }
+
+  int received;
+  int mismatched;
+  int flushed;
+  /// Keys of the failed requests
+  std::string failed;
+
+private:
+  /// Requests stay valid until the connection goes away
+  std::list <xio_msg> reqs_;
+};
+
+/// Deliver all queued events
+static void settle (ACE_Reactor* reactor, xio_context* ctx)
+{
+  while (xio_ace_mock_pending (ctx) > 0)
+  {
+    reactor->handle_events ();
+  }
+}
+
+/// Handle events and timers for a while
+static void run (ACE_Reactor* reactor, const ACE_Time_Value& duration)
+{
+  ACE_Time_Value wait = duration;
+  reactor->handle_events (&wait);
+}
+
+int main (int argc, char* argv[])
+{
+  ACE_Reactor* reactor = ACE_Reactor::instance ();
+  xio_context* ctx = xio_ace_ctx_open (reactor, 0);
+  if (ctx == NULL)
+  {
+    printf("Failed to open context\n");
+    return -1;
+  }
+
+  Test_Server server;
+  server.open (ctx, "mock://reconnect", NULL, 0);
+
+  const ACE_Time_Value backoff (0, 1000);
+  Test_Session session;
+  session.enable_reconnect (reactor, backoff, backoff, 100);
+  session.open ("mock://reconnect", 0, 0, NULL, 0);
+  Test_Connection conn;
+  conn.open (&session, ctx, 0);
+  settle (reactor, ctx);
+
+  // A lost connection replays the idempotent requests only
+  conn.send ("first", true);
+  conn.send ("second", true);
+  conn.send ("once", false);
+  settle (reactor, ctx);
+  check (server.held.size () == 3, "requests received");
+
+  xio_ace_mock_break (conn.connection ());
+  settle (reactor, ctx);
+  check (server.held.empty (), "requests of the lost connection dropped");
+  for (int i = 0; i < 1000 && server.held.size () < 2; ++i)
+  {
+    run (reactor, backoff);
+  }
+  check (conn.connection () != NULL && !session.torn_down, "connection reconnected");
+  check (conn.flushed == 1 && conn.failed == "once ", "request not idempotent failed");
+  check (server.held.size () == 2, "idempotent requests replayed");
+
+  server.answer ();
+  settle (reactor, ctx);
+  check (conn.received == 2 && conn.mismatched == 0, "replayed requests answered");
+  check (conn.outstanding () == 0, "replay log empty");
+
+  // A connection disconnected on purpose is not reconnected
+  conn.send ("last", true);
+  settle (reactor, ctx);
+  conn.disconnect ();
+  settle (reactor, ctx);
+  run (reactor, backoff + backoff);
+  settle (reactor, ctx);
+  check (conn.flushed == 2 && conn.failed == "once last ", "request of a disconnected connection failed");
+  check (conn.connection () == NULL && session.torn_down, "disconnected connection not reconnected");
+
+  server.close ();
+  xio_ctx_close (ctx);
+
+  printf("%s\n", failures == 0 ? "PASSED" : "FAILED");
+  return failures == 0 ? 0 : -1;
+}
@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "xio_ace_replay.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/// Order records by start time
+static bool earlier (const XIO_Event_Record* a, const XIO_Event_Record* b)
+{
+  return a->timestamp_ns < b->timestamp_ns;
+}
+
+/// Sleep until a CLOCK_MONOTONIC time
+static void sleep_until (uint64_t due_ns)
+{
+  struct timespec ts;
+  ts.tv_sec = due_ns / 1000000000ULL;
+  ts.tv_nsec = due_ns % 1000000000ULL;
+  // Interrupted sleeps resume, other errors (returned, not in errno) end it
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+  {
+  }
+}
+
+////////////////////////////////////////////////////////
+///  XIO_Event_Replay
+////////////////////////////////////////////////////////
+XIO_Event_Replay::XIO_Event_Replay ()
+: fd_ (-1)
+, base_ (NULL)
+, length_ (0)
+, records_ (NULL)
+{
+}
+
+XIO_Event_Replay::~XIO_Event_Replay ()
+{
+  if (this->base_)
+  {
+    this->close ();
+  }
+}
+
+int
+XIO_Event_Replay::open (const char* path)
+{
+  if (this->base_)
+  {
+    return -1;
+  }
+
+  int fd = ::open (path, O_RDONLY);
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat (fd, &st) != 0 || static_cast <size_t> (st.st_size) < sizeof (XIO_Event_Log_Header))
+  {
+    ::close (fd);
+    return -1;
+  }
+  size_t length = st.st_size;
+  void* base = mmap (NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+  {
+    ::close (fd);
+    return -1;
+  }
+
+  const XIO_Event_Log_Header* header = reinterpret_cast <const XIO_Event_Log_Header*> (base);
+  if (memcmp (header->magic, "XIOEVLOG", sizeof (header->magic)) != 0 ||
+      header->version != 1 ||
+      header->record_size != sizeof (XIO_Event_Record))
+  {
+    munmap (base, length);
+    ::close (fd);
+    return -1;
+  }
+
+  this->fd_ = fd;
+  this->base_ = base;
+  this->length_ = length;
+  this->records_ = reinterpret_cast <const XIO_Event_Record*> (header + 1);
+
+  // A log that was not closed ends at the first unwritten record
+  size_t count = (length - sizeof (XIO_Event_Log_Header)) / sizeof (XIO_Event_Record);
+  if (header->count != 0 && header->count < count)
+  {
+    count = header->count;
+  }
+
+  size_t payload = 0;
+  this->order_.clear ();
+  this->deferred_.clear ();
+  for (size_t i = 0; i < count && this->records_[i].timestamp_ns != 0; ++i)
+  {
+    const XIO_Event_Record& record = this->records_[i];
+    payload = std::max (payload, static_cast <size_t> (std::max (record.header_len, record.data_len)));
+    this->order_.push_back (&record);
+    if (record.type == XIO_EVENT_DEFERRED_MSG)
+    {
+      this->deferred_.insert (std::make_pair (record.session, record.sn));
+    }
+  }
+
+  // Records are appended when a handler returns, nested events first
+  std::stable_sort (this->order_.begin (), this->order_.end (), earlier);
+  this->payload_.assign (payload + 1, 0);
+  return 0;
+}
+
+int
+XIO_Event_Replay::close ()
+{
+  if (this->base_ == NULL)
+  {
+    return 0;
+  }
+
+  munmap (this->base_, this->length_);
+  int retval = ::close (this->fd_);
+  this->fd_ = -1;
+  this->base_ = NULL;
+  this->length_ = 0;
+  this->records_ = NULL;
+  this->order_.clear ();
+  this->deferred_.clear ();
+  return retval;
+}
+
+size_t
+XIO_Event_Replay::size () const
+{
+  return this->order_.size ();
+}
+
+const XIO_Event_Record&
+XIO_Event_Replay::record (size_t i) const
+{
+  return *this->order_[i];
+}
+
+int
+XIO_Event_Replay::run (XIO_Callback_Implementor& target, double speed, Stats* stats)
+{
+  if (this->base_ == NULL || speed < 0)
+  {
+    return -1;
+  }
+
+  Stats result;
+  memset (&result, 0, sizeof (result));
+
+  uint64_t start = xio_ace_trace_now ();
+  uint64_t first = this->order_.empty () ? 0 : this->order_[0]->timestamp_ns;
+  for (size_t i = 0; i < this->order_.size (); ++i)
+  {
+    const XIO_Event_Record& record = *this->order_[i];
+
+    uint64_t now = xio_ace_trace_now ();
+    if (speed > 0)
+    {
+      uint64_t due = start + static_cast <uint64_t> ((record.timestamp_ns - first) / speed);
+      if (now < due)
+      {
+        sleep_until (due);
+        now = xio_ace_trace_now ();
+      }
+      else
+      {
+        result.max_lag_ns = std::max (result.max_lag_ns, now - due);
+      }
+    }
+
+    ++result.events;
+    if (this->dispatch (target, record))
+    {
+      ++result.callbacks;
+      result.handler_ns += xio_ace_trace_now () - now;
+      result.recorded_handler_ns += record.duration_ns;
+    }
+  }
+
+  if (stats)
+  {
+    *stats = result;
+  }
+  return 0;
+}
+
+bool
+XIO_Event_Replay::dispatch (XIO_Callback_Implementor& target, const XIO_Event_Record& record)
+{
+  xio_session* session = reinterpret_cast <xio_session*> (record.session);
+
+  memset (&this->msg_, 0, sizeof (this->msg_));
+  memset (&this->request_, 0, sizeof (this->request_));
+  this->msg_.type = static_cast <xio_msg_type> (record.msg_type);
+  if (record.msg_type == XIO_MSG_TYPE_RSP)
+  {
+    this->request_.sn = record.sn;
+    this->request_.type = XIO_MSG_TYPE_REQ;
+    this->msg_.request = &this->request_;
+  }
+  else
+  {
+    this->msg_.sn = record.sn;
+  }
+
+  switch (record.type)
+  {
+  case XIO_EVENT_ASSIGN_DATA_IN_BUF:
+    this->fill (this->msg_.in, record);
+    target.assign_data_in_buf (&this->msg_);
+    return true;
+  case XIO_EVENT_ON_MSG:
+    if (record.msg_type == XIO_MSG_TYPE_REQ &&
+        this->deferred_.count (std::make_pair (record.session, record.sn)))
+    {
+      // Only queued, on_msg was called by the DEFERRED_MSG event
+      return false;
+    }
+    // fall through
+  case XIO_EVENT_DEFERRED_MSG:
+    this->fill (this->msg_.in, record);
+    target.on_msg (session, &this->msg_, record.arg);
+    return true;
+  case XIO_EVENT_ON_MSG_DELIVERED:
+    this->fill (this->msg_.out, record);
+    target.on_msg_delivered (session, &this->msg_, record.arg);
+    return true;
+  case XIO_EVENT_ON_MSG_ERROR:
+    this->fill (this->msg_.out, record);
+    target.on_msg_error (session, static_cast <xio_status> (record.arg), &this->msg_);
+    return true;
+  case XIO_EVENT_ON_MSG_SEND_COMPLETE:
+    this->fill (this->msg_.out, record);
+    target.on_msg_send_complete (session, &this->msg_);
+    return true;
+  case XIO_EVENT_ON_NEW_SESSION:
+    {
+      xio_new_session_req req;
+      memset (&req, 0, sizeof (req));
+      target.on_new_session (session, &req);
+      return true;
+    }
+  case XIO_EVENT_ON_SESSION_ESTABLISHED:
+    {
+      xio_new_session_rsp rsp;
+      memset (&rsp, 0, sizeof (rsp));
+      target.on_session_established (session, &rsp);
+      return true;
+    }
+  case XIO_EVENT_ON_SESSION_EVENT:
+    {
+      xio_session_event_data data;
+      memset (&data, 0, sizeof (data));
+      data.event = static_cast <xio_session_event> (record.arg);
+      target.on_session_event (session, &data);
+      return true;
+    }
+  default:
+    return false;
+  }
+}
+
+void
+XIO_Event_Replay::fill (xio_vmsg& vmsg, const XIO_Event_Record& record)
+{
+  vmsg.header.iov_base = record.header_len ? &this->payload_[0] : NULL;
+  vmsg.header.iov_len = record.header_len;
+  if (record.data_len)
+  {
+    vmsg.data_iovlen = 1;
+    vmsg.data_iov[0].iov_base = &this->payload_[0];
+    vmsg.data_iov[0].iov_len = record.data_len;
+  }
+}
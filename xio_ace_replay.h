@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XIO_ACE_REPLAY_H
+#define XIO_ACE_REPLAY_H
+
+#include "xio_ace_event_log.h"
+#include "xio_ace_session.h"
+
+#include <set>
+#include <utility>
+#include <vector>
+
+/**
+ * Replays a recorded event log into a callback implementor.
+ *
+ * The callbacks are called in timestamp order, at the recorded pace or
+ * accelerated, with synthesized messages: zero filled headers and data
+ * of the recorded lengths, the recorded serial numbers and, for
+ * responses, a request carrying the recorded serial number. Sessions are
+ * the addresses of the recording process, so they group the events but
+ * must not be passed to accelio - neither must the messages (a handler
+ * under test should be benchmarked without sending or releasing).
+ * Loop and fd events are kept for their timing only, so are the ON_MSG
+ * events of requests a server deferred: their DEFERRED_MSG event is
+ * replayed as on_msg.
+ */
+class XIO_Event_Replay
+{
+public:
+  /// Results of a replay
+  struct Stats
+  {
+    /// Number of events replayed
+    size_t events;
+    /// Number of callbacks called
+    size_t callbacks;
+    /// Time spent in the callbacks while replaying, in nanoseconds
+    uint64_t handler_ns;
+    /// Time the callbacks took when recorded, in nanoseconds
+    uint64_t recorded_handler_ns;
+    /// Largest delay of a callback behind its schedule, in nanoseconds
+    uint64_t max_lag_ns;
+  };
+
+  XIO_Event_Replay ();
+  virtual ~XIO_Event_Replay ();
+
+  /**
+   * Map a log file
+   *
+   * @return 0 on success, -1 upon error (not a log, other version)
+   */
+  int open (const char* path);
+
+  /// Unmap the log file
+  int close ();
+
+  /// Number of records in the log
+  size_t size () const;
+
+  /// A record, in timestamp order
+  const XIO_Event_Record& record (size_t i) const;
+
+  /**
+   * Replay the log
+   *
+   * @param target The callbacks to drive
+   * @param speed 1 replays at the recorded pace, 2 twice as fast, 0 as
+   *              fast as possible
+   * @param stats Results of the replay, can be NULL
+   *
+   * @return 0 on success, -1 upon error
+   */
+  int run (XIO_Callback_Implementor& target, double speed, Stats* stats);
+
+private:
+  /// Call the callback of a record, return whether there was one
+  bool dispatch (XIO_Callback_Implementor& target, const XIO_Event_Record& record);
+  /// Synthesize a message
+  void fill (xio_vmsg& vmsg, const XIO_Event_Record& record);
+
+  int fd_;
+  void* base_;
+  size_t length_;
+  const XIO_Event_Record* records_;
+  /// Records in timestamp order
+  std::vector <const XIO_Event_Record*> order_;
+  /// Session and serial number of the requests dispatched after their
+  /// ON_MSG event
+  std::set <std::pair <uint64_t, uint64_t> > deferred_;
+  /// Zero filled payload of the synthesized messages
+  std::vector <char> payload_;
+  xio_msg msg_;
+  xio_msg request_;
+};
+
+#endif // XIO_ACE_REPLAY_H
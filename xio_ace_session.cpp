@@ -38,8 +38,77 @@
  */
 
 #include "xio_ace_session.h"
+#include "xio_ace_event_log.h"
+#include "xio_ace_metrics.h"
+#include "xio_ace_trace.h"
 
+#include <algorithm>
 #include <assert.h>
+#include <time.h>
+
+XIO_Hooks xio_ace_hooks = { NULL, NULL, NULL, NULL, NULL };
+
+////////////////////////////////////////////////////////
+///  Hooks
+////////////////////////////////////////////////////////
+/// CLOCK_MONOTONIC time in nanoseconds, the clock of the hooks
+static uint64_t now_ns ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return static_cast <uint64_t> (ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/// Trace a stage of a request now
+static inline void trace_stage (XIO_Trace_Stage stage, xio_session* session, uint64_t sn)
+{
+  if (xio_ace_hooks.trace)
+  {
+    xio_ace_hooks.trace (stage, session, sn, 0);
+  }
+}
+
+/// Start recording an event if an event log is attached
+static inline void event_begin (XIO_Event_Record& record,
+                                XIO_Event_Type type,
+                                xio_session* session,
+                                xio_msg* msg,
+                                int arg)
+{
+  record.timestamp_ns = 0;
+  if (xio_ace_hooks.event_fill)
+  {
+    xio_ace_hooks.event_fill (record, type, session, msg, arg);
+  }
+}
+
+/// Add to a counter of the calling thread if metrics are enabled
+static inline void metric_add (XIO_Metric metric, uint64_t n = 1)
+{
+  if (xio_ace_hooks.metric_add)
+  {
+    xio_ace_hooks.metric_add (metric, n);
+  }
+}
+
+/// Count a session event if metrics are enabled
+static inline void session_event (xio_session_event_data* data)
+{
+  if (xio_ace_hooks.session_event)
+  {
+    xio_ace_hooks.session_event (data);
+  }
+}
+
+/// Finish recording an event started with event_begin
+static inline void event_end (XIO_Event_Record& record)
+{
+  void (*append) (XIO_Event_Record&) = xio_ace_hooks.event_append;
+  if (record.timestamp_ns != 0 && append)
+  {
+    append (record);
+  }
+}
 
 ////////////////////////////////////////////////////////
 ///  ACE context ops
@@ -66,18 +135,38 @@ public:
   /// Called when input events occur (e.g., connection or data).
   virtual int handle_input(ACE_HANDLE fd)
   {
+    uint64_t begin = xio_ace_hooks.metric_add ? now_ns () : 0;
+    XIO_Event_Record event;
+    event_begin (event, XIO_EVENT_FD, NULL, NULL, fd);
     this->handler_ (fd, 0, this->data_);
+    event_end (event);
+    this->count (begin);
     return 0;
   }
   /// Called when output events are possible (e.g., when flow control
   /// abates or non-blocking connection completes).
   virtual int handle_output(ACE_HANDLE fd)
   {
+    uint64_t begin = xio_ace_hooks.metric_add ? now_ns () : 0;
+    XIO_Event_Record event;
+    event_begin (event, XIO_EVENT_FD, NULL, NULL, fd);
     this->handler_ (fd, 0, this->data_);
+    event_end (event);
+    this->count (begin);
     return 0;
   }
 
 private:
+  /// Count a call of the handler that started at begin
+  void count (uint64_t begin)
+  {
+    if (begin != 0)
+    {
+      metric_add (XIO_METRIC_FD_EVENTS);
+      metric_add (XIO_METRIC_FD_BUSY_NS, now_ns () - begin);
+    }
+  }
+
   ACE_HANDLE fd_;
   xio_ev_handler_t handler_;
   void* data_;
@@ -102,23 +191,46 @@ static int static_add_xio_handler(void* void_reactor,
     mask |= ACE_Event_Handler::WRITE_MASK;
   }
 
-  return reactor->register_handler (new XIO_Event_Handler (fd, handler, data), mask);
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_LOOP_ADD, NULL, NULL, fd);
+  event.sn = events;
+  int retval = reactor->register_handler (new XIO_Event_Handler (fd, handler, data), mask);
+  event_end (event);
+  return retval;
 }
 
 /// Remove a handler
 static int static_remove_xio_handler(void* void_reactor, int fd)
 {
   ACE_Reactor* reactor = reinterpret_cast <ACE_Reactor*> (void_reactor);
-  return reactor->remove_handler (fd, ACE_Event_Handler::ALL_EVENTS_MASK);
+
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_LOOP_REMOVE, NULL, NULL, fd);
+  int retval = reactor->remove_handler (fd, ACE_Event_Handler::ALL_EVENTS_MASK);
+  event_end (event);
+  return retval;
 }
 
 static struct xio_loop_ops ACE_REACTOR_LOOP_OPS = { static_add_xio_handler, static_remove_xio_handler };
 
+/// Context opened last by the thread
+static __thread struct xio_context* current_context = NULL;
+
 
 struct xio_context *xio_ace_ctx_open(ACE_Reactor *reactor,
                                      int polling_timeout_us)
 {
-  return xio_ctx_open (&ACE_REACTOR_LOOP_OPS, reactor, polling_timeout_us);
+  struct xio_context* ctx = xio_ctx_open (&ACE_REACTOR_LOOP_OPS, reactor, polling_timeout_us);
+  if (ctx)
+  {
+    current_context = ctx;
+  }
+  return ctx;
+}
+
+struct xio_context* xio_ace_ctx_current ()
+{
+  return current_context;
 }
 
 
@@ -138,7 +250,23 @@ static_on_msg (xio_session* session,
     assert (obj != NULL);
     return -1;
   }
-  return obj->on_msg (session, msg, more_in_batch);
+
+  metric_add (XIO_METRIC_MSGS_RECEIVED);
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_ON_MSG, session, msg, more_in_batch);
+
+  // Requests are received on servers, responses on clients
+  uint64_t sn = xio_ace_trace_sn (msg);
+  bool response = msg->type == XIO_MSG_TYPE_RSP;
+  trace_stage (response ? XIO_TRACE_CLIENT_RECEIVE : XIO_TRACE_SERVER_RECEIVE, session, sn);
+  int retval = obj->on_msg (session, msg, more_in_batch);
+  if (response)
+  {
+    trace_stage (XIO_TRACE_CLIENT_DONE, session, sn);
+  }
+
+  event_end (event);
+  return retval;
 }
 
 template <class T>
@@ -154,7 +282,12 @@ static_on_msg_delivered (struct xio_session *session,
     assert (obj != NULL);
     return -1;
   }
-  return obj->on_msg_delivered (session, msg, more_in_batch);
+
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_ON_MSG_DELIVERED, session, msg, more_in_batch);
+  int retval = obj->on_msg_delivered (session, msg, more_in_batch);
+  event_end (event);
+  return retval;
 }
 
 template <class T>
@@ -170,7 +303,13 @@ static_on_msg_error (xio_session* session,
     assert (obj != NULL);
     return -1;
   }
-  return obj->on_msg_error (session, error, msg);
+
+  metric_add (XIO_METRIC_MSG_ERRORS);
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_ON_MSG_ERROR, session, msg, error);
+  int retval = obj->on_msg_error (session, error, msg);
+  event_end (event);
+  return retval;
 }
 
 template <class T>
@@ -185,7 +324,14 @@ static_on_msg_send_complete (xio_session* session,
     assert (obj != NULL);
     return -1;
   }
-  return obj->on_msg_send_complete (session, msg);
+  trace_stage (XIO_TRACE_SEND_COMPLETE, session, xio_ace_trace_sn (msg));
+  metric_add (XIO_METRIC_SEND_COMPLETES);
+
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_ON_MSG_SEND_COMPLETE, session, msg, 0);
+  int retval = obj->on_msg_send_complete (session, msg);
+  event_end (event);
+  return retval;
 }
 
 template <class T>
@@ -198,7 +344,12 @@ static_assign_data_in_buf (xio_msg* msg, void* cb_user_context)
     assert (obj != NULL);
     return -1;
   }
-  return obj->assign_data_in_buf (msg);
+
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_ASSIGN_DATA_IN_BUF, NULL, msg, 0);
+  int retval = obj->assign_data_in_buf (msg);
+  event_end (event);
+  return retval;
 }
 
 template <class T>
@@ -213,7 +364,12 @@ static_on_session_established (xio_session* session,
     assert (obj != NULL);
     return -1;
   }
-  return obj->on_session_established (session, rsp);
+
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_ON_SESSION_ESTABLISHED, session, NULL, 0);
+  int retval = obj->on_session_established (session, rsp);
+  event_end (event);
+  return retval;
 }
 
 template <class T>
@@ -226,7 +382,13 @@ static_on_session_event (xio_session* session, xio_session_event_data* data, voi
     assert (obj != NULL);
     return -1;
   }
-  return obj->on_session_event (session, data);
+
+  session_event (data);
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_ON_SESSION_EVENT, session, NULL, data->event);
+  int retval = obj->on_session_event (session, data);
+  event_end (event);
+  return retval;
 }
 
 template <class T>
@@ -239,7 +401,12 @@ static_on_new_session (xio_session* session, xio_new_session_req* req, void* cb_
     assert (obj != NULL);
     return -1;
   }
-  return obj->on_new_session (session, req);
+
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_ON_NEW_SESSION, session, NULL, 0);
+  int retval = obj->on_new_session (session, req);
+  event_end (event);
+  return retval;
 }
 
 ////////////////////////////////////////////////////////
@@ -330,13 +497,54 @@ void XIO_Callback_Implementor::fill_callbacks (xio_session_ops& ses_ops)
 }
 
 
+////////////////////////////////////////////////////////
+///  XIO_Server_Cache
+////////////////////////////////////////////////////////
+XIO_Server_Cache::~XIO_Server_Cache ()
+{
+}
+
 ////////////////////////////////////////////////////////
 ///  XIO_Server
 ////////////////////////////////////////////////////////
+/// Marks the responses sent by the default on_msg_rejected
+static char XIO_SERVER_REJECTED_RESPONSE;
+
+const char XIO_Server::BUSY_HEADER[] = "XIO_SERVER_BUSY";
+
+/**
+ * Dispatches the prioritized requests of a server
+ */
+class XIO_Priority_Dispatcher : public ACE_Event_Handler
+{
+public:
+  XIO_Priority_Dispatcher (XIO_Server* server)
+  : server_ (server)
+  {
+  }
+
+  virtual int handle_exception (ACE_HANDLE fd)
+  {
+    this->server_->dispatch_deferred ();
+    return 0;
+  }
+
+private:
+  XIO_Server* server_;
+};
+
 XIO_Server::XIO_Server (Callback implemented_callbacks)
 : XIO_Callback_Implementor (implemented_callbacks)
 , server_ (NULL)
+, reactor_ (NULL)
+, low_priority_budget_ (0)
+, notified_ (false)
+, dispatcher_ (NULL)
+, cache_ (NULL)
+, callbacks_ (0)
 {
+  memset (&this->limits_, 0, sizeof (this->limits_));
+  memset (&this->load_, 0, sizeof (this->load_));
 }
 
 XIO_Server::~XIO_Server ()
@@ -345,6 +553,11 @@ XIO_Server::~XIO_Server ()
   {
     this->close ();
   }
+  if (this->dispatcher_)
+  {
+    this->reactor_->purge_pending_notifications (this->dispatcher_);
+    delete this->dispatcher_;
+  }
 }
 
 struct xio_server*
@@ -357,6 +570,16 @@ XIO_Server::open (struct xio_context *ctx,
   xio_session_ops ops;
   this->fill_callbacks (ops);
 
+  // Admission control sees every session, request and response first
+  ops.on_new_session = static_admit_session;
+  ops.on_session_event = static_track_session_event;
+  if (this->is_implemented (XIO_CB_ON_MSG))
+  {
+    ops.on_msg = static_admit_msg;
+  }
+  ops.on_msg_send_complete = static_response_sent;
+  ops.on_msg_error = static_response_error;
+
   // Create server
   this->server_ = xio_bind (ctx, &ops, uri, src_port, flags, this);
 
@@ -385,121 +608,1164 @@ XIO_Server::server ()
   return this->server_;
 }
 
+void
+XIO_Server::limits (const Limits& limits)
+{
+  this->limits_ = limits;
+}
 
-////////////////////////////////////////////////////////
-///  XIO_Reqeust_Session
-////////////////////////////////////////////////////////
-XIO_Reqeust_Session::XIO_Reqeust_Session (Callback implemented_callbacks)
-: XIO_Callback_Implementor (implemented_callbacks)
-, session_ (NULL)
+const XIO_Server::Limits&
+XIO_Server::limits () const
 {
+  return this->limits_;
 }
 
-XIO_Reqeust_Session::~XIO_Reqeust_Session ()
+const XIO_Server::Load&
+XIO_Server::load () const
 {
-  if (this->session_)
+  return this->load_;
+}
+
+size_t
+XIO_Server::session_requests (xio_session* session) const
+{
+  Session_Requests::const_iterator it = this->session_requests_.find (session);
+  if (it == this->session_requests_.end ())
   {
-    this->close ();
+    return 0;
   }
+  return it->second;
 }
 
-struct xio_session*
-XIO_Reqeust_Session::open (const char *uri,
-                           uint32_t initial_sn,
-                           uint32_t flags,
-                           void* user_context,
-                           size_t user_context_len)
+void
+XIO_Server::prioritize (ACE_Reactor* reactor, size_t low_priority_budget)
 {
-  // Create session ops
-  xio_session_ops ops;
-  this->fill_callbacks (ops);
+  this->reactor_ = reactor;
+  this->low_priority_budget_ = low_priority_budget;
+  if (this->dispatcher_ == NULL)
+  {
+    this->dispatcher_ = new XIO_Priority_Dispatcher (this);
+  }
+}
 
-  // Create session attributes
-  xio_session_attr attr;
-  memset (&attr, 0, sizeof (attr));
-  attr.ses_ops = &ops;
-  attr.user_context = user_context;
-  attr.user_context_len = user_context_len;
+void
+XIO_Server::session_priority (xio_session* session, int priority)
+{
+  this->session_priorities_[session] = priority;
+}
 
-  // Create session
-  this->session_ = xio_session_open (XIO_SESSION_REQ, &attr, uri, initial_sn, flags, this);
-  return this->session_;
+void
+XIO_Server::response_cache (XIO_Server_Cache* cache)
+{
+  this->cache_ = cache;
 }
 
 int
-XIO_Reqeust_Session::close ()
+XIO_Server::send_response (xio_session* session, xio_msg* rsp)
 {
-  if (this->session_ == NULL)
+  std::vector <XIO_Server_Cache::Request> failed;
+  if (this->cache_)
   {
-    return 0;
+    this->cache_->store (rsp, failed);
   }
 
-  int retval = xio_session_close (this->session_);
+  int retval = xio_send_response (rsp);
   if (retval == 0)
   {
-    this->session_ = NULL;
+    trace_stage (XIO_TRACE_SERVER_RESPONSE, session, xio_ace_trace_sn (rsp));
+  }
+  XIO_Server_Cache::Request next;
+  if (retval != 0 && this->cache_ && this->cache_->abandon (rsp->request, next))
+  {
+    // No completion follows, the collapsed requests are computed now
+    this->dispatch_uncached (next.session, next.msg);
+  }
+
+  // The cached response could not be sent to them, they are computed
+  for (size_t i = 0; i < failed.size (); ++i)
+  {
+    this->dispatch_uncached (failed[i].session, failed[i].msg);
   }
   return retval;
 }
 
-struct xio_session*
-XIO_Reqeust_Session::session ()
+bool
+XIO_Server::is_busy (const xio_msg* rsp)
 {
-  return this->session_;
+  return rsp->in.header.iov_len == sizeof (BUSY_HEADER) - 1 &&
+         memcmp (rsp->in.header.iov_base, BUSY_HEADER, sizeof (BUSY_HEADER) - 1) == 0;
 }
 
+int
+XIO_Server::on_msg_rejected (xio_session* session, xio_msg* msg)
+{
+  xio_msg* response = new xio_msg;
+  memset (response, 0, sizeof (xio_msg));
+  response->request = msg;
+  response->user_context = &XIO_SERVER_REJECTED_RESPONSE;
+  response->out.header.iov_base = const_cast <char*> (BUSY_HEADER);
+  response->out.header.iov_len = sizeof (BUSY_HEADER) - 1;
+  if (xio_send_response (response) != 0)
+  {
+    delete response;
+    return -1;
+  }
+  return 0;
+}
 
-////////////////////////////////////////////////////////
-///  XIO_Connection
-////////////////////////////////////////////////////////
-XIO_Connection::XIO_Connection ()
-: XIO_Callback_Implementor (XIO_CB_NONE)
-, session_ (NULL)
-, connection_ (NULL)
+bool
+XIO_Server::cacheable (xio_session* session, xio_msg* msg)
 {
+  return false;
 }
 
-XIO_Connection::~XIO_Connection ()
+int
+XIO_Server::admit_session (xio_session* session, xio_new_session_req* req)
 {
-  if (this->connection_)
+  if (this->limits_.max_sessions != 0 &&
+      this->load_.sessions >= this->limits_.max_sessions)
   {
-    this->close ();
+    ++this->load_.rejected_sessions;
+    metric_add (XIO_METRIC_SESSIONS_REJECTED);
+    return xio_reject (session, XIO_E_SESSION_REFUSED, NULL, 0);
+  }
+
+  if (this->is_implemented (XIO_CB_ON_NEW_SESSION))
+  {
+    // The subclass may reject it, it is counted once it connects
+    return this->on_new_session (session, req);
+  }
+
+  int retval = xio_accept (session, NULL, 0, NULL, 0);
+  if (retval == 0)
+  {
+    this->track_session (session);
   }
+  return retval;
 }
 
-struct xio_connection*
-XIO_Connection::open (XIO_Reqeust_Session *session,
-                      struct xio_context *ctx,
-                      int conn_idx)
+XIO_Server::Session_Requests::iterator
+XIO_Server::track_session (xio_session* session)
 {
-  if (this->connection_)
+  Session_Requests::iterator it = this->session_requests_.find (session);
+  if (it == this->session_requests_.end ())
   {
-    // Cannot create a new connection when already connected
-    return NULL;
+    it = this->session_requests_.insert (std::make_pair (session, (size_t) 0)).first;
+    ++this->load_.sessions;
+    metric_add (XIO_METRIC_SESSIONS_ADMITTED);
   }
+  return it;
+}
 
-  // Connect
-  this->session_ = session;
-  this->connection_ = xio_connect (this->session_->session (), ctx, conn_idx, this);
-  return this->connection_;
+int
+XIO_Server::admit_msg (xio_session* session, xio_msg* msg, int more_in_batch)
+{
+  if (msg->type != XIO_MSG_TYPE_REQ)
+  {
+    // No response will follow, nothing to account for
+    return this->on_msg (session, msg, more_in_batch);
+  }
+
+  Session_Requests::iterator it = this->track_session (session);
+
+  bool reject =
+    (this->limits_.max_session_requests != 0 &&
+     it->second >= this->limits_.max_session_requests) ||
+    (this->limits_.max_requests != 0 &&
+     this->load_.requests >= this->limits_.max_requests);
+
+  // Rejected requests are outstanding as well until they are answered
+  ++it->second;
+  ++this->load_.requests;
+
+  if (reject)
+  {
+    ++this->load_.rejected_requests;
+    metric_add (XIO_METRIC_REQUESTS_REJECTED);
+    int retval = this->on_msg_rejected (session, msg);
+    if (retval != 0)
+    {
+      // No response follows, the request is no longer outstanding
+      --it->second;
+      --this->load_.requests;
+    }
+    return retval;
+  }
+  metric_add (XIO_METRIC_REQUESTS_ADMITTED);
+
+  if (this->cache_ && this->cacheable (session, msg))
+  {
+    XIO_Server_Cache::Lookup lookup = this->cache_->lookup (session, msg);
+    if (lookup == XIO_Server_Cache::HIT)
+    {
+      trace_stage (XIO_TRACE_SERVER_RESPONSE, session, xio_ace_trace_sn (msg));
+      return 0;
+    }
+    if (lookup == XIO_Server_Cache::COLLAPSED)
+    {
+      return 0;
+    }
+  }
+  if (this->reactor_)
+  {
+    return this->defer_msg (session, msg);
+  }
+  return this->on_msg (session, msg, more_in_batch);
 }
 
-void
-XIO_Connection::close ()
+bool
+XIO_Server::response_done (xio_session* session, xio_msg* msg)
 {
-  this->session_ = NULL;
-  this->connection_ = NULL;
+  if (msg->request != NULL)
+  {
+    Session_Requests::iterator it = this->session_requests_.find (session);
+    if (it != this->session_requests_.end () && it->second > 0)
+    {
+      --it->second;
+      --this->load_.requests;
+    }
+  }
+
+  if (msg->user_context == &XIO_SERVER_REJECTED_RESPONSE)
+  {
+    delete msg;
+    return true;
+  }
+
+  if (this->cache_)
+  {
+    if (this->cache_->complete (msg))
+    {
+      return true;
+    }
+
+    // A response that was not stored, its collapsed requests are computed
+    XIO_Server_Cache::Request next;
+    if (msg->request != NULL && this->cache_->abandon (msg->request, next))
+    {
+      this->dispatch_uncached (next.session, next.msg);
+    }
+  }
+  return false;
 }
 
-XIO_Reqeust_Session*
-XIO_Connection::session ()
+int
+XIO_Server::track_session_event (xio_session* session, xio_session_event_data* data)
 {
-  return this->session_;
+  if (data->event == XIO_SESSION_NEW_CONNECTION_EVENT ||
+      data->event == XIO_SESSION_CONNECTION_ESTABLISHED_EVENT)
+  {
+    this->track_session (session);
+  }
+
+  if (data->event == XIO_SESSION_TEARDOWN_EVENT)
+  {
+    Session_Requests::iterator it = this->session_requests_.find (session);
+    if (it != this->session_requests_.end ())
+    {
+      // Responses of a torn down session are never completed
+      this->load_.requests -= it->second;
+      --this->load_.sessions;
+      this->session_requests_.erase (it);
+    }
+    this->session_priorities_.erase (session);
+    this->purge_deferred (session);
+
+    if (this->cache_)
+    {
+      std::vector <XIO_Server_Cache::Request> next;
+      this->cache_->purge (session, next);
+      for (size_t i = 0; i < next.size (); ++i)
+      {
+        this->dispatch_uncached (next[i].session, next[i].msg);
+      }
+    }
+  }
+
+  if (this->is_implemented (XIO_CB_ON_SESSION_EVENT))
+  {
+    return this->on_session_event (session, data);
+  }
+  return 0;
 }
 
-struct xio_connection*
-XIO_Connection::connection ()
+int
+XIO_Server::defer_msg (xio_session* session, xio_msg* msg)
 {
-  return this->connection_;
+  int priority = 0;
+  Session_Priorities::iterator it = this->session_priorities_.find (session);
+  if (it != this->session_priorities_.end ())
+  {
+    priority = it->second;
+  }
+
+  Deferred_Msg deferred = { session, msg };
+  this->deferred_[priority].push_back (deferred);
+  ++this->load_.deferred;
+
+  // Dispatched after the reactor handled the pending I/O events
+  if (!this->notified_)
+  {
+    this->notified_ = true;
+    if (this->reactor_->notify (this->dispatcher_, ACE_Event_Handler::EXCEPT_MASK) != 0)
+    {
+      this->notified_ = false;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void
+XIO_Server::dispatch_deferred ()
+{
+  this->notified_ = false;
+
+  if (this->deferred_.empty ())
+  {
+    return;
+  }
+
+  // The highest priority is drained, the others share the budget
+  int highest = this->deferred_.begin ()->first;
+  size_t budget = this->low_priority_budget_;
+  while (!this->deferred_.empty ())
+  {
+    // on_msg may change the queues, look the level up every time
+    Priority_Queues::iterator level = this->deferred_.begin ();
+    if (level->second.empty ())
+    {
+      this->deferred_.erase (level);
+      continue;
+    }
+
+    if (level->first < highest)
+    {
+      if (budget == 0)
+      {
+        break;
+      }
+      --budget;
+    }
+
+    Deferred_Msg deferred = level->second.front ();
+    level->second.pop_front ();
+    --this->load_.deferred;
+    this->dispatch_msg (deferred.session, deferred.msg, !level->second.empty ());
+  }
+
+  if (!this->deferred_.empty () && !this->notified_)
+  {
+    this->notified_ = true;
+    if (this->reactor_->notify (this->dispatcher_, ACE_Event_Handler::EXCEPT_MASK) != 0)
+    {
+      this->notified_ = false;
+    }
+  }
+}
+
+int
+XIO_Server::dispatch_msg (xio_session* session, xio_msg* msg, int more_in_batch)
+{
+  metric_add (XIO_METRIC_REQUESTS_DEFERRED);
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_DEFERRED_MSG, session, msg, more_in_batch);
+  trace_stage (XIO_TRACE_SERVER_DISPATCH, session, xio_ace_trace_sn (msg));
+  int retval = this->on_msg (session, msg, more_in_batch);
+  event_end (event);
+  return retval;
 }
 
+void
+XIO_Server::purge_deferred (xio_session* session)
+{
+  Priority_Queues::iterator level = this->deferred_.begin ();
+  while (level != this->deferred_.end ())
+  {
+    std::deque <Deferred_Msg>& queue = level->second;
+    for (std::deque <Deferred_Msg>::iterator it = queue.begin (); it != queue.end (); )
+    {
+      if (it->session == session)
+      {
+        it = queue.erase (it);
+        --this->load_.deferred;
+      }
+      else
+      {
+        ++it;
+      }
+    }
+
+    if (queue.empty ())
+    {
+      this->deferred_.erase (level++);
+    }
+    else
+    {
+      ++level;
+    }
+  }
+
+  for (std::deque <Deferred_Msg>::iterator it = this->promoted_.begin (); it != this->promoted_.end (); )
+  {
+    it = it->session == session ? this->promoted_.erase (it) : it + 1;
+  }
+}
+
+int
+XIO_Server::dispatch_uncached (xio_session* session, xio_msg* msg)
+{
+  if (this->reactor_)
+  {
+    return this->defer_msg (session, msg);
+  }
+
+  // on_msg is not reentered, the request waits for the running callback
+  Deferred_Msg promoted = { session, msg };
+  this->promoted_.push_back (promoted);
+  if (this->callbacks_ == 0)
+  {
+    this->enter_callback ();
+    this->leave_callback ();
+  }
+  return 0;
+}
+
+void
+XIO_Server::enter_callback ()
+{
+  ++this->callbacks_;
+}
+
+void
+XIO_Server::leave_callback ()
+{
+  // The outermost callback dispatches the requests promoted meanwhile
+  while (this->callbacks_ == 1 && !this->promoted_.empty ())
+  {
+    Deferred_Msg promoted = this->promoted_.front ();
+    this->promoted_.pop_front ();
+    this->dispatch_msg (promoted.session, promoted.msg, !this->promoted_.empty ());
+  }
+  --this->callbacks_;
+}
+
+int
+XIO_Server::static_admit_session (xio_session* session,
+                                  xio_new_session_req* req,
+                                  void* cb_user_context)
+{
+  XIO_Server* obj = reinterpret_cast <XIO_Server*> (cb_user_context);
+  if (obj == NULL)
+  {
+    assert (obj != NULL);
+    return -1;
+  }
+
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_ON_NEW_SESSION, session, NULL, 0);
+  int retval = obj->admit_session (session, req);
+  event_end (event);
+  return retval;
+}
+
+int
+XIO_Server::static_admit_msg (xio_session* session,
+                              xio_msg* msg,
+                              int more_in_batch,
+                              void* cb_user_context)
+{
+  XIO_Server* obj = reinterpret_cast <XIO_Server*> (cb_user_context);
+  if (obj == NULL)
+  {
+    assert (obj != NULL);
+    return -1;
+  }
+
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_ON_MSG, session, msg, more_in_batch);
+
+  metric_add (XIO_METRIC_MSGS_RECEIVED);
+  trace_stage (XIO_TRACE_SERVER_RECEIVE, session, xio_ace_trace_sn (msg));
+  obj->enter_callback ();
+  int retval = obj->admit_msg (session, msg, more_in_batch);
+
+  event_end (event);
+  obj->leave_callback ();
+  return retval;
+}
+
+int
+XIO_Server::static_response_sent (xio_session* session,
+                                  xio_msg* msg,
+                                  void* cb_user_context)
+{
+  XIO_Server* obj = reinterpret_cast <XIO_Server*> (cb_user_context);
+  if (obj == NULL)
+  {
+    assert (obj != NULL);
+    return -1;
+  }
+  trace_stage (XIO_TRACE_SEND_COMPLETE, session, xio_ace_trace_sn (msg));
+  metric_add (XIO_METRIC_SEND_COMPLETES);
+
+  int retval = 0;
+  obj->enter_callback ();
+  if (!obj->response_done (session, msg) &&
+      obj->is_implemented (XIO_CB_ON_MSG_SEND_COMPLETE))
+  {
+    XIO_Event_Record event;
+    event_begin (event, XIO_EVENT_ON_MSG_SEND_COMPLETE, session, msg, 0);
+    retval = obj->on_msg_send_complete (session, msg);
+    event_end (event);
+  }
+  obj->leave_callback ();
+  return retval;
+}
+
+int
+XIO_Server::static_response_error (xio_session* session,
+                                   xio_status error,
+                                   xio_msg* msg,
+                                   void* cb_user_context)
+{
+  XIO_Server* obj = reinterpret_cast <XIO_Server*> (cb_user_context);
+  if (obj == NULL)
+  {
+    assert (obj != NULL);
+    return -1;
+  }
+  int retval = 0;
+  obj->enter_callback ();
+  if (!obj->response_done (session, msg) &&
+      obj->is_implemented (XIO_CB_ON_MSG_ERROR))
+  {
+    metric_add (XIO_METRIC_MSG_ERRORS);
+    XIO_Event_Record event;
+    event_begin (event, XIO_EVENT_ON_MSG_ERROR, session, msg, error);
+    retval = obj->on_msg_error (session, error, msg);
+    event_end (event);
+  }
+  obj->leave_callback ();
+  return retval;
+}
+
+int
+XIO_Server::static_track_session_event (xio_session* session,
+                                        xio_session_event_data* data,
+                                        void* cb_user_context)
+{
+  XIO_Server* obj = reinterpret_cast <XIO_Server*> (cb_user_context);
+  if (obj == NULL)
+  {
+    assert (obj != NULL);
+    return -1;
+  }
+
+  session_event (data);
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_ON_SESSION_EVENT, session, NULL, data->event);
+  obj->enter_callback ();
+  int retval = obj->track_session_event (session, data);
+  event_end (event);
+  obj->leave_callback ();
+  return retval;
+}
+
+
+////////////////////////////////////////////////////////
+///  XIO_Reqeust_Session
+////////////////////////////////////////////////////////
+/**
+ * Fires the reconnect attempts of a session
+ */
+class XIO_Reconnect_Handler : public ACE_Event_Handler
+{
+public:
+  XIO_Reconnect_Handler (XIO_Reqeust_Session* session)
+  : session_ (session)
+  {
+  }
+
+  virtual int handle_timeout (const ACE_Time_Value& current_time, const void* act)
+  {
+    this->session_->reconnect ();
+    return 0;
+  }
+
+private:
+  XIO_Reqeust_Session* session_;
+};
+
+XIO_Reqeust_Session::XIO_Reqeust_Session (Callback implemented_callbacks)
+: XIO_Callback_Implementor (implemented_callbacks)
+, session_ (NULL)
+, initial_sn_ (0)
+, flags_ (0)
+, reactor_ (NULL)
+, max_attempts_ (0)
+, attempts_ (0)
+, timer_id_ (-1)
+, reconnect_handler_ (NULL)
+{
+}
+
+XIO_Reqeust_Session::~XIO_Reqeust_Session ()
+{
+  if (this->session_)
+  {
+    this->close ();
+  }
+  if (this->timer_id_ != -1)
+  {
+    this->reactor_->cancel_timer (this->timer_id_);
+  }
+  delete this->reconnect_handler_;
+}
+
+struct xio_session*
+XIO_Reqeust_Session::open (const char *uri,
+                           uint32_t initial_sn,
+                           uint32_t flags,
+                           void* user_context,
+                           size_t user_context_len)
+{
+  this->uri_ = uri;
+  this->initial_sn_ = initial_sn;
+  this->flags_ = flags;
+  this->user_context_.assign (reinterpret_cast <char*> (user_context),
+                              reinterpret_cast <char*> (user_context) + user_context_len);
+  return this->open_session ();
+}
+
+int
+XIO_Reqeust_Session::close ()
+{
+  if (this->timer_id_ != -1)
+  {
+    this->reactor_->cancel_timer (this->timer_id_);
+    this->timer_id_ = -1;
+  }
+
+  if (this->session_ == NULL)
+  {
+    return 0;
+  }
+
+  int retval = xio_session_close (this->session_);
+  if (retval == 0)
+  {
+    this->session_ = NULL;
+  }
+  return retval;
+}
+
+struct xio_session*
+XIO_Reqeust_Session::session ()
+{
+  return this->session_;
+}
+
+void
+XIO_Reqeust_Session::enable_reconnect (ACE_Reactor* reactor,
+                                       const ACE_Time_Value& initial_backoff,
+                                       const ACE_Time_Value& max_backoff,
+                                       int max_attempts)
+{
+  assert (this->session_ == NULL);
+  this->reactor_ = reactor;
+  this->initial_backoff_ = initial_backoff;
+  this->max_backoff_ = max_backoff;
+  this->max_attempts_ = max_attempts;
+  if (this->reconnect_handler_ == NULL)
+  {
+    this->reconnect_handler_ = new XIO_Reconnect_Handler (this);
+  }
+}
+
+bool
+XIO_Reqeust_Session::reconnect_enabled () const
+{
+  return this->reactor_ != NULL;
+}
+
+void
+XIO_Reqeust_Session::add_connection (XIO_Connection* conn)
+{
+  if (std::find (this->connections_.begin (), this->connections_.end (), conn) ==
+      this->connections_.end ())
+  {
+    this->connections_.push_back (conn);
+  }
+}
+
+void
+XIO_Reqeust_Session::remove_connection (XIO_Connection* conn)
+{
+  std::vector <XIO_Connection*>::iterator it =
+    std::find (this->connections_.begin (), this->connections_.end (), conn);
+  if (it != this->connections_.end ())
+  {
+    this->connections_.erase (it);
+  }
+}
+
+struct xio_session*
+XIO_Reqeust_Session::open_session ()
+{
+  // Create session ops
+  xio_session_ops ops;
+  this->fill_callbacks (ops);
+
+  if (this->reconnect_enabled ())
+  {
+    // Connection loss is handled before the subclass sees it
+    ops.on_session_event = static_track_session_event;
+    ops.on_msg_error = static_replay_msg_error;
+  }
+
+  // Create session attributes
+  xio_session_attr attr;
+  memset (&attr, 0, sizeof (attr));
+  attr.ses_ops = &ops;
+  attr.user_context = this->user_context_.empty () ? NULL : &this->user_context_[0];
+  attr.user_context_len = this->user_context_.size ();
+
+  // Create session
+  this->session_ = xio_session_open (XIO_SESSION_REQ, &attr, this->uri_.c_str (),
+                                     this->initial_sn_, this->flags_, this);
+  return this->session_;
+}
+
+int
+XIO_Reqeust_Session::track_session_event (xio_session* session, xio_session_event_data* data)
+{
+  XIO_Connection* conn = reinterpret_cast <XIO_Connection*> (data->conn_user_context);
+  bool reconnectable = conn && conn->session_ == this && !conn->closing_;
+
+  switch (data->event)
+  {
+  case XIO_SESSION_CONNECTION_DISCONNECTED_EVENT:
+    if (reconnectable)
+    {
+      // Let the library close it, reconnect once it is closed
+      xio_disconnect (data->conn);
+      return 0;
+    }
+    break;
+  case XIO_SESSION_CONNECTION_CLOSED_EVENT:
+  case XIO_SESSION_CONNECTION_ERROR_EVENT:
+  case XIO_SESSION_CONNECTION_REFUSED_EVENT:
+    if (reconnectable)
+    {
+      conn->lost ();
+      this->schedule_reconnect ();
+      return 0;
+    }
+    break;
+  case XIO_SESSION_CONNECTION_ESTABLISHED_EVENT:
+    if (reconnectable && conn->lost_)
+    {
+      conn->replay ();
+    }
+    this->attempts_ = 0;
+    break;
+  case XIO_SESSION_TEARDOWN_EVENT:
+    for (size_t i = 0; i < this->connections_.size (); ++i)
+    {
+      if (this->connections_[i]->lost_ && !this->connections_[i]->closing_)
+      {
+        // Reopened by the next reconnect attempt
+        xio_session_close (this->session_);
+        this->session_ = NULL;
+        this->schedule_reconnect ();
+        return 0;
+      }
+    }
+    break;
+  default:
+    break;
+  }
+
+  if (this->is_implemented (XIO_CB_ON_SESSION_EVENT))
+  {
+    return this->on_session_event (session, data);
+  }
+  return 0;
+}
+
+void
+XIO_Reqeust_Session::schedule_reconnect ()
+{
+  if (this->timer_id_ != -1)
+  {
+    return;
+  }
+
+  if (this->max_attempts_ > 0 && this->attempts_ >= this->max_attempts_)
+  {
+    this->give_up ();
+    return;
+  }
+
+  // initial_backoff * 2^attempts, bounded by max_backoff
+  ACE_Time_Value delay = this->initial_backoff_;
+  for (int i = 0; i < this->attempts_ && delay < this->max_backoff_; ++i)
+  {
+    delay += delay;
+  }
+  if (delay > this->max_backoff_)
+  {
+    delay = this->max_backoff_;
+  }
+
+  ++this->attempts_;
+  this->timer_id_ = this->reactor_->schedule_timer (this->reconnect_handler_, NULL, delay);
+}
+
+void
+XIO_Reqeust_Session::reconnect ()
+{
+  this->timer_id_ = -1;
+
+  if (this->session_ == NULL && this->open_session () == NULL)
+  {
+    this->schedule_reconnect ();
+    return;
+  }
+
+  bool failed = false;
+  for (size_t i = 0; i < this->connections_.size (); ++i)
+  {
+    XIO_Connection* conn = this->connections_[i];
+    if (conn->lost_ && !conn->closing_ && conn->connection_ == NULL &&
+        conn->reconnect () == NULL)
+    {
+      failed = true;
+    }
+  }
+
+  if (failed)
+  {
+    this->schedule_reconnect ();
+  }
+}
+
+void
+XIO_Reqeust_Session::give_up ()
+{
+  this->attempts_ = 0;
+
+  // The subclass may close (and remove) connections while reporting
+  std::vector <XIO_Connection*> connections (this->connections_);
+  for (size_t i = 0; i < connections.size (); ++i)
+  {
+    if (connections[i]->lost_ && !connections[i]->closing_)
+    {
+      this->report_closed (connections[i]);
+    }
+  }
+
+  if (this->session_ == NULL && this->is_implemented (XIO_CB_ON_SESSION_EVENT))
+  {
+    xio_session_event_data data;
+    memset (&data, 0, sizeof (data));
+    data.event = XIO_SESSION_TEARDOWN_EVENT;
+    this->on_session_event (NULL, &data);
+  }
+}
+
+void
+XIO_Reqeust_Session::report_closed (XIO_Connection* conn)
+{
+  while (!conn->replay_log_.empty ())
+  {
+    xio_msg* msg = conn->replay_log_.front ().msg;
+    conn->replay_log_.pop_front ();
+    conn->fail_request (msg);
+  }
+  conn->lost_ = false;
+
+  if (this->is_implemented (XIO_CB_ON_SESSION_EVENT))
+  {
+    xio_session_event_data data;
+    memset (&data, 0, sizeof (data));
+    data.event = XIO_SESSION_CONNECTION_CLOSED_EVENT;
+    data.conn_user_context = conn;
+    this->on_session_event (this->session_, &data);
+  }
+}
+
+int
+XIO_Reqeust_Session::static_track_session_event (xio_session* session,
+                                                 xio_session_event_data* data,
+                                                 void* cb_user_context)
+{
+  XIO_Reqeust_Session* obj = reinterpret_cast <XIO_Reqeust_Session*> (cb_user_context);
+  if (obj == NULL)
+  {
+    assert (obj != NULL);
+    return -1;
+  }
+
+  session_event (data);
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_ON_SESSION_EVENT, session, NULL, data->event);
+  int retval = obj->track_session_event (session, data);
+  event_end (event);
+  return retval;
+}
+
+int
+XIO_Reqeust_Session::static_replay_msg_error (xio_session* session,
+                                              xio_status error,
+                                              xio_msg* msg,
+                                              void* cb_user_context)
+{
+  XIO_Callback_Implementor* obj = reinterpret_cast <XIO_Callback_Implementor*> (cb_user_context);
+  if (obj == NULL)
+  {
+    assert (obj != NULL);
+    return -1;
+  }
+
+  // The context is the connection, unless it was opened without one
+  XIO_Connection* conn = dynamic_cast <XIO_Connection*> (obj);
+  if (conn && conn->keep_for_replay (msg, error))
+  {
+    return 0;
+  }
+
+  XIO_Reqeust_Session* owner = conn ? conn->session_ : dynamic_cast <XIO_Reqeust_Session*> (obj);
+  if (owner && !owner->is_implemented (XIO_CB_ON_MSG_ERROR))
+  {
+    return 0;
+  }
+
+  metric_add (XIO_METRIC_MSG_ERRORS);
+  XIO_Event_Record event;
+  event_begin (event, XIO_EVENT_ON_MSG_ERROR, session, msg, error);
+  int retval = obj->on_msg_error (session, error, msg);
+  event_end (event);
+  return retval;
+}
+
+
+////////////////////////////////////////////////////////
+///  XIO_Connection
+////////////////////////////////////////////////////////
+XIO_Connection::XIO_Connection ()
+: XIO_Callback_Implementor (XIO_CB_NONE)
+, session_ (NULL)
+, connection_ (NULL)
+, ctx_ (NULL)
+, conn_idx_ (0)
+, closing_ (false)
+, lost_ (false)
+{
+}
+
+XIO_Connection::~XIO_Connection ()
+{
+  if (this->connection_ || this->session_)
+  {
+    this->close ();
+  }
+}
+
+struct xio_connection*
+XIO_Connection::open (XIO_Reqeust_Session *session,
+                      struct xio_context *ctx,
+                      int conn_idx)
+{
+  if (this->connection_)
+  {
+    // Cannot create a new connection when already connected
+    return NULL;
+  }
+
+  // Connect
+  this->session_ = session;
+  this->ctx_ = ctx;
+  this->conn_idx_ = conn_idx;
+  this->closing_ = false;
+  this->lost_ = false;
+  this->connection_ = xio_connect (this->session_->session (), ctx, conn_idx, this);
+  if (this->connection_)
+  {
+    this->session_->add_connection (this);
+  }
+  return this->connection_;
+}
+
+int
+XIO_Connection::disconnect ()
+{
+  this->closing_ = true;
+  if (this->connection_)
+  {
+    return xio_disconnect (this->connection_);
+  }
+
+  if (this->lost_ && this->session_)
+  {
+    // Waiting to be reconnected, no close event will follow
+    this->session_->report_closed (this);
+  }
+  return 0;
+}
+
+void
+XIO_Connection::close ()
+{
+  if (this->session_)
+  {
+    this->session_->remove_connection (this);
+  }
+  this->session_ = NULL;
+  this->connection_ = NULL;
+  this->lost_ = false;
+  this->replay_log_.clear ();
+}
+
+int
+XIO_Connection::send_request (xio_msg* msg, bool idempotent)
+{
+  bool logged = this->session_ && this->session_->reconnect_enabled ();
+
+  if (this->connection_ == NULL)
+  {
+    if (logged && this->lost_ && !this->closing_ && idempotent)
+    {
+      // Sent by replay once reconnected
+      Logged_Request entry = { msg, idempotent };
+      this->replay_log_.push_back (entry);
+      return 0;
+    }
+    return -1;
+  }
+
+  // The serial number is assigned by xio_send_request
+  void (*trace) (int, xio_session*, uint64_t, uint64_t) = xio_ace_hooks.trace;
+  uint64_t posted = trace ? now_ns () : 0;
+  int retval = xio_send_request (this->connection_, msg);
+  if (retval == 0 && trace)
+  {
+    xio_session* session = this->session_ ? this->session_->session () : NULL;
+    trace (XIO_TRACE_POST, session, msg->sn, posted);
+    trace (XIO_TRACE_SEND, session, msg->sn, 0);
+  }
+  if (retval == 0)
+  {
+    metric_add (XIO_METRIC_REQUESTS_SENT);
+  }
+  if (retval == 0 && logged)
+  {
+    Logged_Request entry = { msg, idempotent };
+    this->replay_log_.push_back (entry);
+  }
+  return retval;
+}
+
+int
+XIO_Connection::release_response (xio_msg* rsp)
+{
+  // Responses mostly arrive in order, the entry is usually the first
+  for (Replay_Log::iterator it = this->replay_log_.begin ();
+       it != this->replay_log_.end ();
+       ++it)
+  {
+    if (it->msg == rsp->request)
+    {
+      this->replay_log_.erase (it);
+      break;
+    }
+  }
+  return xio_release_response (rsp);
+}
+
+XIO_Reqeust_Session*
+XIO_Connection::session ()
+{
+  return this->session_;
+}
+
+struct xio_connection*
+XIO_Connection::connection ()
+{
+  return this->connection_;
+}
+
+size_t
+XIO_Connection::outstanding () const
+{
+  return this->replay_log_.size ();
+}
+
+void
+XIO_Connection::lost ()
+{
+  // Requests that cannot be replayed are failed by the library flush
+  // or by replay, whichever comes first
+  this->lost_ = true;
+  this->connection_ = NULL;
+}
+
+struct xio_connection*
+XIO_Connection::reconnect ()
+{
+  metric_add (XIO_METRIC_RECONNECTS);
+  this->connection_ = xio_connect (this->session_->session (), this->ctx_, this->conn_idx_, this);
+  return this->connection_;
+}
+
+void
+XIO_Connection::replay ()
+{
+  this->lost_ = false;
+
+  Replay_Log::iterator it = this->replay_log_.begin ();
+  while (it != this->replay_log_.end ())
+  {
+    xio_msg* msg = it->msg;
+    if (it->idempotent && xio_send_request (this->connection_, msg) == 0)
+    {
+      ++it;
+      continue;
+    }
+    it = this->replay_log_.erase (it);
+    this->fail_request (msg);
+  }
+}
+
+void
+XIO_Connection::fail_request (xio_msg* msg, xio_status error)
+{
+  xio_session* session = this->session_ ? this->session_->session () : NULL;
+  XIO_Reqeust_Session::static_replay_msg_error (session, error, msg, this);
+}
+
+bool
+XIO_Connection::keep_for_replay (xio_msg* msg, xio_status error)
+{
+  for (Replay_Log::iterator it = this->replay_log_.begin ();
+       it != this->replay_log_.end ();
+       ++it)
+  {
+    if (it->msg != msg)
+    {
+      continue;
+    }
+
+    // Only the flush of a connection that was not disconnected on
+    // purpose is replayed, real errors are reported. The flush comes
+    // before the close event that marks the connection lost
+    if (it->idempotent && error == XIO_E_MSG_FLUSHED && !this->closing_)
+    {
+      return true;
+    }
+    this->replay_log_.erase (it);
+    return false;
+  }
+  return false;
+}
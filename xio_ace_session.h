@@ -42,6 +42,14 @@
 
 #include <libxio.h>
 #include <ace/Reactor.h>
+#include <ace/Time_Value.h>
+
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
 
 /**
  * creates xio context - a context is mapped internaly to
@@ -57,6 +65,35 @@
 struct xio_context* xio_ace_ctx_open(ACE_Reactor *reactor,
                                      int polling_timeout_us);
 
+/// The context the calling thread opened last with xio_ace_ctx_open
+struct xio_context* xio_ace_ctx_current ();
+
+struct XIO_Event_Record;
+
+/**
+ * Instrumentation hooks of the wrappers, NULL (off) by default.
+ *
+ * xio_ace_trace_enable, xio_ace_event_log_attach and
+ * xio_ace_metrics_enable install them, so the wrappers link without the
+ * modules a program does not use.
+ */
+struct XIO_Hooks
+{
+  /// Record a stage (XIO_Trace_Stage) of a request if it is sampled
+  void (*trace) (int stage, xio_session* session, uint64_t sn, uint64_t timestamp_ns);
+  /// Fill a record at the start of an event (XIO_Event_Type)
+  void (*event_fill) (XIO_Event_Record& record, int type, xio_session* session,
+                      xio_msg* msg, int arg);
+  /// Append a record at the end of an event
+  void (*event_append) (XIO_Event_Record& record);
+  /// Add to a counter (XIO_Metric) of the calling thread
+  void (*metric_add) (int metric, uint64_t n);
+  /// Count a session event
+  void (*session_event) (xio_session_event_data* data);
+};
+
+extern XIO_Hooks xio_ace_hooks;
+
 
 /**
  * Base class for all classes that implement xio callbacks
@@ -115,13 +152,130 @@ private:
 };
 
 
+class XIO_Priority_Dispatcher;
+
+/**
+ * A cache answering identical requests of a server, see
+ * XIO_Server::response_cache and XIO_Response_Cache
+ */
+class XIO_Server_Cache
+{
+public:
+  /// Outcome of a lookup
+  enum Lookup
+  {
+    /// Not cached, the request is computed and its response stored
+    MISS,
+    /// Answered with a cached response
+    HIT,
+    /// Waits for the response of an identical request being computed
+    COLLAPSED,
+    /// Not cacheable (too large or the cached response failed to send)
+    BYPASS
+  };
+
+  /// A request of a session
+  struct Request
+  {
+    xio_session* session;
+    xio_msg* msg;
+  };
+
+  virtual ~XIO_Server_Cache ();
+
+  /**
+   * Look a request up, answering it on a hit
+   *
+   * @return MISS if the request is to be computed, BYPASS if it is to
+   *         be computed without caching, HIT or COLLAPSED if it is
+   *         answered by the cache
+   */
+  virtual Lookup lookup (xio_session* session, xio_msg* req) = 0;
+
+  /**
+   * Keep the response of a missed request and answer the requests
+   * collapsed onto it
+   *
+   * @param rsp The response
+   * @param failed Set to the collapsed requests the response could not
+   *               be sent to, they have to be computed
+   *
+   * @return 0 on success, -1 if the request was not a miss or the
+   *         response could not be copied
+   */
+  virtual int store (xio_msg* rsp, std::vector <Request>& failed) = 0;
+
+  /**
+   * Give up on a missed request whose response was not stored
+   *
+   * @param req The missed request
+   * @param next Set to a collapsed request that now has to be computed
+   *
+   * @return true if next was set
+   */
+  virtual bool abandon (xio_msg* req, Request& next) = 0;
+
+  /**
+   * Drop the requests of a torn down session
+   *
+   * @param session The session
+   * @param next Collapsed requests of other sessions that now have to be
+   *             computed
+   */
+  virtual void purge (xio_session* session, std::vector <Request>& next) = 0;
+
+  /**
+   * Release a sent or failed message
+   *
+   * @return true if the message was a cached response
+   */
+  virtual bool complete (xio_msg* msg) = 0;
+};
+
 /**
  * A server instance.
  * Can be bound to a URI and accept new connections
+ *
+ * The server applies admission control before the callbacks of the
+ * subclass are called: new sessions above the session limit are
+ * rejected and requests above the outstanding request limits are
+ * passed to on_msg_rejected instead of on_msg. A request is
+ * outstanding from on_msg until its response is sent (or fails).
+ *
+ * When prioritization is enabled, admitted requests are not passed to
+ * on_msg from the accelio callback. They are queued per session
+ * priority and dispatched from a reactor notification, highest
+ * priority first, with a budget for the lower priorities per pass.
  */
 class XIO_Server : public XIO_Callback_Implementor
 {
 public:
+  /// Admission limits, 0 means unlimited
+  struct Limits
+  {
+    /// Maximal number of sessions
+    size_t max_sessions;
+    /// Maximal number of outstanding requests per session
+    size_t max_session_requests;
+    /// Maximal number of outstanding requests in the server
+    size_t max_requests;
+  };
+
+  /// Current load of the server
+  struct Load
+  {
+    /// Number of accepted sessions
+    size_t sessions;
+    /// Number of outstanding requests
+    size_t requests;
+    /// Number of sessions rejected so far
+    size_t rejected_sessions;
+    /// Number of requests rejected so far
+    size_t rejected_requests;
+    /// Number of requests queued for prioritized dispatch
+    size_t deferred;
+  };
+
   /**
    * Create a new server
    *
@@ -157,11 +311,163 @@ public:
   /// Accessor to the server handle
   struct xio_server* server ();
 
+  /// Set the admission limits (may be called at any time)
+  void limits (const Limits& limits);
+  /// Accessor to the admission limits
+  const Limits& limits () const;
+  /// Accessor to the current load
+  const Load& load () const;
+  /// Number of outstanding requests of a session
+  size_t session_requests (xio_session* session) const;
+
+  /**
+   * Dispatch requests by session priority.
+   *
+   * @param reactor The reactor running the server's context
+   * @param low_priority_budget Maximal number of requests of the lower
+   *                            priorities dispatched per reactor pass
+   *                            (the highest queued priority is always
+   *                            drained)
+   */
+  void prioritize (ACE_Reactor* reactor, size_t low_priority_budget);
+
+  /// Set the priority of a session (higher first, default 0)
+  void session_priority (xio_session* session, int priority);
+
+  /// Header of the response sent by the default on_msg_rejected
+  static const char BUSY_HEADER[];
+
+  /**
+   * Whether a received response is the default rejection of a busy
+   * server: no data and BUSY_HEADER (without its terminating null) as
+   * the header
+   */
+  static bool is_busy (const xio_msg* rsp);
+
+  /**
+   * Answer identical requests from a response cache. Admitted requests
+   * the subclass declares cacheable are looked up before they are
+   * dispatched, the responses sent with send_response are stored.
+   *
+   * @param cache The cache, NULL to disable caching. It must outlive the
+   *              responses it sent.
+   */
+  void response_cache (XIO_Server_Cache* cache);
+
+  /**
+   * Send a response, storing it in the response cache. Responses sent
+   * with xio_send_response are not cached (identical requests waiting
+   * for them are dispatched once they completed).
+   *
+   * @param session The session of the request
+   * @param rsp The response
+   *
+   * @return 0 on success, -1 upon error
+   */
+  int send_response (xio_session* session, xio_msg* rsp);
+
 protected:
+  /**
+   * Called instead of on_msg for a request that exceeds the limits.
+   * The default implementation answers with BUSY_HEADER (see is_busy),
+   * override it to send an application level "busy" error. The request
+   * stays outstanding until the response is sent.
+   *
+   * @return 0 if a response was sent, -1 if none will be
+   */
+  virtual int on_msg_rejected (xio_session* session, xio_msg* msg);
+
+  /**
+   * Whether an admitted request goes through the response cache. Its
+   * response must depend on the request bytes alone. The default
+   * implementation caches nothing.
+   */
+  virtual bool cacheable (xio_session* session, xio_msg* msg);
+
   /// The server handle (NULL before open is called)
   struct xio_server *server_;
+
+private:
+  typedef std::map <xio_session*, size_t> Session_Requests;
+  typedef std::map <xio_session*, int> Session_Priorities;
+
+  /// A request waiting to be dispatched
+  struct Deferred_Msg
+  {
+    xio_session* session;
+    xio_msg* msg;
+  };
+
+  typedef std::map <int, std::deque <Deferred_Msg>, std::greater <int> > Priority_Queues;
+
+  friend class XIO_Priority_Dispatcher;
+
+  /// Admission control entry points, called before the subclass
+  int admit_session (xio_session* session, xio_new_session_req* req);
+  int admit_msg (xio_session* session, xio_msg* msg, int more_in_batch);
+  /// Count an accepted session once, return its entry
+  Session_Requests::iterator track_session (xio_session* session);
+  /// Account for a sent or failed message, true if it was ours
+  bool response_done (xio_session* session, xio_msg* msg);
+  int track_session_event (xio_session* session, xio_session_event_data* data);
+  /// Queue an admitted request by the priority of its session
+  int defer_msg (xio_session* session, xio_msg* msg);
+  /// Dispatch queued requests, called from the reactor notification
+  void dispatch_deferred ();
+  /// Call on_msg with a request whose callback already returned
+  int dispatch_msg (xio_session* session, xio_msg* msg, int more_in_batch);
+  /// Drop the queued requests of a torn down session
+  void purge_deferred (xio_session* session);
+  /// Dispatch a request the response cache no longer answers, queued
+  /// like a prioritized one or until the running callbacks returned
+  int dispatch_uncached (xio_session* session, xio_msg* msg);
+  /// Bracket the callbacks, see dispatch_uncached
+  void enter_callback ();
+  void leave_callback ();
+
+  static int static_admit_session (xio_session* session,
+                                   xio_new_session_req* req,
+                                   void* cb_user_context);
+  static int static_admit_msg (xio_session* session,
+                               xio_msg* msg,
+                               int more_in_batch,
+                               void* cb_user_context);
+  static int static_response_sent (xio_session* session,
+                                   xio_msg* msg,
+                                   void* cb_user_context);
+  static int static_response_error (xio_session* session,
+                                    xio_status error,
+                                    xio_msg* msg,
+                                    void* cb_user_context);
+  static int static_track_session_event (xio_session* session,
+                                         xio_session_event_data* data,
+                                         void* cb_user_context);
+
+  Limits limits_;
+  Load load_;
+  /// Outstanding requests per session
+  Session_Requests session_requests_;
+
+  /// Prioritization state (reactor_ is NULL when disabled)
+  ACE_Reactor* reactor_;
+  size_t low_priority_budget_;
+  Session_Priorities session_priorities_;
+  Priority_Queues deferred_;
+  bool notified_;
+  XIO_Priority_Dispatcher* dispatcher_;
+
+  /// Response cache, NULL if disabled
+  XIO_Server_Cache* cache_;
+  /// Requests the cache no longer answers, waiting for the running
+  /// callbacks to return (without prioritization)
+  std::deque <Deferred_Msg> promoted_;
+  /// Number of running callbacks
+  int callbacks_;
 };
 
+class XIO_Connection;
+class XIO_Reconnect_Handler;
+
 /**
  * A request session.
  *
@@ -169,6 +475,14 @@ protected:
  * Note that the implemented callbacks passed to the session include
  * the callbacks implemented by the session as well as callbacks
  * implemented by the connection objects that will be used...
+ *
+ * When reconnect is enabled, lost connections (ones that were not
+ * closed by XIO_Connection::disconnect) are reconnected with an
+ * exponential backoff, and a torn down session is reopened. The
+ * disconnect, close and teardown events of such connections are not
+ * passed to on_session_event unless reconnecting gives up. Idempotent
+ * requests sent with XIO_Connection::send_request are replayed on the
+ * new connection, other outstanding requests fail with on_msg_error.
  */
 class XIO_Reqeust_Session : public XIO_Callback_Implementor
 {
@@ -210,9 +524,73 @@ public:
   /// Accessor to the session handle
   struct xio_session* session ();
 
+  /**
+   * Enable automatic reconnect.
+   * Must be called before open.
+   *
+   * @param reactor The reactor running the connections' context, used
+   *                for the backoff timer
+   * @param initial_backoff Delay before the first reconnect attempt
+   * @param max_backoff Upper bound of the (doubling) delay
+   * @param max_attempts Attempts before giving up (0 means forever)
+   */
+  void enable_reconnect (ACE_Reactor* reactor,
+                         const ACE_Time_Value& initial_backoff,
+                         const ACE_Time_Value& max_backoff,
+                         int max_attempts);
+
+  /// Whether reconnect is enabled
+  bool reconnect_enabled () const;
+
 private:
+  friend class XIO_Connection;
+  friend class XIO_Reconnect_Handler;
+
+  /// Connection bookkeeping, called by XIO_Connection
+  void add_connection (XIO_Connection* conn);
+  void remove_connection (XIO_Connection* conn);
+
+  /// Reconnect handling, called before the subclass callbacks
+  int track_session_event (xio_session* session, xio_session_event_data* data);
+  /// Open the session with the stored parameters
+  struct xio_session* open_session ();
+  /// Schedule the next reconnect attempt
+  void schedule_reconnect ();
+  /// Reopen the session and reconnect the lost connections
+  void reconnect ();
+  /// Stop reconnecting and report the lost connections
+  void give_up ();
+  /// Fail the requests of a lost connection and report it as closed
+  void report_closed (XIO_Connection* conn);
+
+  static int static_track_session_event (xio_session* session,
+                                         xio_session_event_data* data,
+                                         void* cb_user_context);
+  static int static_replay_msg_error (xio_session* session,
+                                      xio_status error,
+                                      xio_msg* msg,
+                                      void* cb_user_context);
+
   /// The session (NULL before open is called)
   struct xio_session* session_;
+
+  /// Open parameters, kept to reopen the session
+  std::string uri_;
+  uint32_t initial_sn_;
+  uint32_t flags_;
+  std::vector <char> user_context_;
+
+  /// Connections opened on this session
+  std::vector <XIO_Connection*> connections_;
+
+  /// Reconnect state (reactor_ is NULL when reconnect is disabled)
+  ACE_Reactor* reactor_;
+  ACE_Time_Value initial_backoff_;
+  ACE_Time_Value max_backoff_;
+  int max_attempts_;
+  int attempts_;
+  long timer_id_;
+  XIO_Reconnect_Handler* reconnect_handler_;
 };
 
 
@@ -242,6 +620,12 @@ public:
                                struct xio_context *ctx,
                                int conn_idx);
 
+  /**
+   * Disconnect the connection on purpose.
+   * The connection will not be reconnected
+   */
+  int disconnect ();
+
   /**
    * Mark the connection as closed
    * This should only be called after getting
@@ -249,16 +633,67 @@ public:
    */
   void close ();
 
+  /**
+   * Send a request
+   *
+   * @param msg The request, must stay valid until its response is
+   *            released
+   * @param idempotent Whether the request may be replayed after a
+   *                   reconnect
+   */
+  int send_request (xio_msg* msg, bool idempotent);
+
+  /// Release a response (must be used instead of xio_release_response)
+  int release_response (xio_msg* rsp);
+
   /// Accessor to the session
   XIO_Reqeust_Session* session ();
   /// Accessor to the connection handle
   struct xio_connection* connection ();
+  /// Number of requests waiting for a response in the replay log
+  size_t outstanding () const;
+
+  /**
+   * Fail a request that was not sent, it is reported to on_msg_error
+   * like a message failed by the library
+   */
+  void fail_request (xio_msg* msg, xio_status error = XIO_E_MSG_FLUSHED);
 
 private:
+  friend class XIO_Reqeust_Session;
+
+  /// A request waiting for its response
+  struct Logged_Request
+  {
+    xio_msg* msg;
+    bool idempotent;
+  };
+
+  typedef std::list <Logged_Request> Replay_Log;
+
+  /// The connection was lost, drop the requests that cannot be replayed
+  void lost ();
+  /// Connect again after the connection was lost
+  struct xio_connection* reconnect ();
+  /// Resend the replay log on the new connection
+  void replay ();
+  /// Whether a failed message is kept for replay, erases it otherwise
+  bool keep_for_replay (xio_msg* msg, xio_status error);
+
   /// The session this connection belongs to
   XIO_Reqeust_Session* session_;
   /// The connection (NULL before open is called)
   struct xio_connection* connection_;
+
+  /// Open parameters, kept to reconnect
+  struct xio_context* ctx_;
+  int conn_idx_;
+  /// disconnect was called
+  bool closing_;
+  /// The connection was lost and waits to be reconnected
+  bool lost_;
+  /// Requests waiting for a response (only when reconnect is enabled)
+  Replay_Log replay_log_;
 };
 
 #endif // XIO_ACE_SESSION_H
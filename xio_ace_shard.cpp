@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "xio_ace_shard.h"
+
+#include <set>
+#include <stdio.h>
+
+////////////////////////////////////////////////////////
+///  XIO_Sharded_Client
+////////////////////////////////////////////////////////
+XIO_Sharded_Client::XIO_Sharded_Client (struct xio_context* ctx, size_t virtual_nodes)
+: ctx_ (ctx)
+, virtual_nodes_ (virtual_nodes > 0 ? virtual_nodes : 1)
+{
+}
+
+XIO_Sharded_Client::~XIO_Sharded_Client ()
+{
+  for (Shard_Map::iterator it = this->shards_.begin (); it != this->shards_.end (); ++it)
+  {
+    delete it->second->connection;
+    delete it->second->session;
+    delete it->second;
+  }
+  for (size_t i = 0; i < this->retired_.size (); ++i)
+  {
+    delete this->retired_[i]->connection;
+    delete this->retired_[i]->session;
+    delete this->retired_[i];
+  }
+}
+
+int
+XIO_Sharded_Client::members (const std::vector <std::string>& uris)
+{
+  std::set <std::string> wanted (uris.begin (), uris.end ());
+
+  // Retire servers that left, collect first as removal invalidates
+  std::vector <std::string> removed;
+  for (Shard_Map::iterator it = this->shards_.begin (); it != this->shards_.end (); ++it)
+  {
+    if (wanted.find (it->first) == wanted.end ())
+    {
+      removed.push_back (it->first);
+    }
+  }
+  for (size_t i = 0; i < removed.size (); ++i)
+  {
+    this->remove_member (removed[i]);
+  }
+
+  int retval = 0;
+  for (std::set <std::string>::iterator it = wanted.begin (); it != wanted.end (); ++it)
+  {
+    if (this->shards_.find (*it) == this->shards_.end () &&
+        this->add_member (*it) != 0)
+    {
+      retval = -1;
+    }
+  }
+  return retval;
+}
+
+int
+XIO_Sharded_Client::add_member (const std::string& uri)
+{
+  if (this->shards_.find (uri) != this->shards_.end ())
+  {
+    return 0;
+  }
+
+  Shard* shard = new Shard;
+  shard->uri = uri;
+  shard->session = this->create_session (uri);
+  shard->connection = this->create_connection (uri);
+
+  if (shard->session->open (uri.c_str (), 0, 0, NULL, 0) == NULL ||
+      shard->connection->open (shard->session, this->ctx_, 0) == NULL)
+  {
+    delete shard->connection;
+    delete shard->session;
+    delete shard;
+    return -1;
+  }
+
+  this->shards_[uri] = shard;
+  for (size_t n = 0; n < this->virtual_nodes_; ++n)
+  {
+    // On the (unlikely) collision the first server keeps the point
+    this->ring_.insert (std::make_pair (point (uri, n), shard));
+  }
+  return 0;
+}
+
+int
+XIO_Sharded_Client::remove_member (const std::string& uri)
+{
+  Shard_Map::iterator it = this->shards_.find (uri);
+  if (it == this->shards_.end ())
+  {
+    return -1;
+  }
+
+  Shard* shard = it->second;
+  this->shards_.erase (it);
+  for (size_t n = 0; n < this->virtual_nodes_; ++n)
+  {
+    Ring::iterator point_it = this->ring_.find (point (uri, n));
+    if (point_it != this->ring_.end () && point_it->second == shard)
+    {
+      this->ring_.erase (point_it);
+    }
+  }
+
+  // On purpose, a session with reconnect enabled must not reconnect it
+  shard->connection->disconnect ();
+  this->retired_.push_back (shard);
+  return 0;
+}
+
+XIO_Connection*
+XIO_Sharded_Client::route (const void* key, size_t key_len)
+{
+  Shard* shard = this->lookup (key, key_len);
+  return shard ? shard->connection : NULL;
+}
+
+const std::string*
+XIO_Sharded_Client::route_uri (const void* key, size_t key_len)
+{
+  Shard* shard = this->lookup (key, key_len);
+  return shard ? &shard->uri : NULL;
+}
+
+size_t
+XIO_Sharded_Client::reap ()
+{
+  std::vector <Shard*> remaining;
+  for (size_t i = 0; i < this->retired_.size (); ++i)
+  {
+    Shard* shard = this->retired_[i];
+    if (shard->session->session () != NULL)
+    {
+      remaining.push_back (shard);
+      continue;
+    }
+    delete shard->connection;
+    delete shard->session;
+    delete shard;
+  }
+  this->retired_.swap (remaining);
+  return this->retired_.size ();
+}
+
+size_t
+XIO_Sharded_Client::size () const
+{
+  return this->shards_.size ();
+}
+
+uint64_t
+XIO_Sharded_Client::hash (const void* data, size_t len)
+{
+  // FNV-1a followed by the murmur3 finalizer to spread close keys
+  const unsigned char* bytes = reinterpret_cast <const unsigned char*> (data);
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; ++i)
+  {
+    h ^= bytes[i];
+    h *= 1099511628211ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+XIO_Sharded_Client::Shard*
+XIO_Sharded_Client::lookup (const void* key, size_t key_len)
+{
+  if (this->ring_.empty ())
+  {
+    return NULL;
+  }
+
+  // The first point clockwise from the key owns it
+  Ring::iterator it = this->ring_.lower_bound (hash (key, key_len));
+  if (it == this->ring_.end ())
+  {
+    it = this->ring_.begin ();
+  }
+  return it->second;
+}
+
+uint64_t
+XIO_Sharded_Client::point (const std::string& uri, size_t n)
+{
+  // The whole uri is hashed, however long it is
+  char suffix[32];
+  snprintf (suffix, sizeof (suffix), "#%lu", (unsigned long) n);
+  std::string name = uri + suffix;
+  return hash (name.data (), name.size ());
+}
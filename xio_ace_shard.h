@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XIO_ACE_SHARD_H
+#define XIO_ACE_SHARD_H
+
+#include "xio_ace_session.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * A client holding a session per server and routing requests by key.
+ *
+ * Keys are mapped to servers with a consistent hash ring where each
+ * server owns a number of virtual nodes, so a membership change only
+ * moves the keys of the added/removed servers and leaves the sessions
+ * of all other servers untouched.
+ *
+ * Subclasses create the session and connection objects (and thereby
+ * decide which callbacks are implemented).
+ */
+class XIO_Sharded_Client
+{
+public:
+  /**
+   * Create an empty client
+   *
+   * @param ctx Context handle the connections are opened on
+   * @param virtual_nodes Number of ring points per server
+   */
+  XIO_Sharded_Client (struct xio_context* ctx, size_t virtual_nodes);
+  virtual ~XIO_Sharded_Client ();
+
+  /**
+   * Set the servers, opening sessions to new servers and retiring the
+   * sessions of servers that are no longer members
+   *
+   * @return 0 on success, -1 if a session could not be opened
+   */
+  int members (const std::vector <std::string>& uris);
+
+  /**
+   * Add a server
+   *
+   * @return 0 on success, -1 if the session could not be opened
+   */
+  int add_member (const std::string& uri);
+
+  /**
+   * Remove a server.
+   * Its connection is disconnected, the objects are deleted by reap
+   * once the session was closed.
+   *
+   * @return 0 on success, -1 if the uri is not a member
+   */
+  int remove_member (const std::string& uri);
+
+  /**
+   * Find the connection owning a key
+   *
+   * @return The connection, or NULL if there are no members
+   */
+  XIO_Connection* route (const void* key, size_t key_len);
+
+  /// Find the uri of the server owning a key (NULL if there are no members)
+  const std::string* route_uri (const void* key, size_t key_len);
+
+  /**
+   * Delete the objects of retired servers whose session was closed
+   *
+   * @return The number of retired servers still waiting to be closed
+   */
+  size_t reap ();
+
+  /// Number of servers
+  size_t size () const;
+
+protected:
+  /// Create (but do not open) the session for a server
+  virtual XIO_Reqeust_Session* create_session (const std::string& uri) = 0;
+  /// Create (but do not open) the connection for a server
+  virtual XIO_Connection* create_connection (const std::string& uri) = 0;
+
+private:
+  struct Shard
+  {
+    std::string uri;
+    XIO_Reqeust_Session* session;
+    XIO_Connection* connection;
+  };
+
+  typedef std::map <uint64_t, Shard*> Ring;
+  typedef std::map <std::string, Shard*> Shard_Map;
+
+  /// Hash used for both ring points and keys
+  static uint64_t hash (const void* data, size_t len);
+  /// Find the ring point owning a key
+  Shard* lookup (const void* key, size_t key_len);
+  /// Ring point of the n-th virtual node of a server
+  static uint64_t point (const std::string& uri, size_t n);
+
+  struct xio_context* ctx_;
+  size_t virtual_nodes_;
+  Ring ring_;
+  Shard_Map shards_;
+  std::vector <Shard*> retired_;
+};
+
+#endif // XIO_ACE_SHARD_H
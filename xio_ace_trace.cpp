@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "xio_ace_trace.h"
+#include "xio_ace_session.h"
+
+#include <ace/Guard_T.h>
+#include <ace/Thread_Mutex.h>
+
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+
+/**
+ * The ring of a thread.
+ * Written by its thread only, head is published with release semantics
+ * so an exporter sees complete records (unless the ring wraps while it
+ * copies - export a quiescent process for exact results).
+ */
+struct Trace_Ring
+{
+  XIO_Trace_Record* records;
+  uint64_t mask;
+  uint64_t head;
+  uint32_t thread;
+};
+
+static ACE_Thread_Mutex trace_lock;
+static std::vector <Trace_Ring*> trace_rings;
+static size_t trace_ring_size = 65536;
+static __thread Trace_Ring* trace_ring = NULL;
+
+uint64_t xio_ace_trace_sample_mask = ~(uint64_t) 0;
+
+static const char* const TRACE_STAGE_NAMES[XIO_TRACE_STAGES] =
+{
+  "post",
+  "send",
+  "send_complete",
+  "server_receive",
+  "server_response",
+  "client_receive",
+  "client_done",
+  "server_dispatch",
+};
+
+/// Create the ring of the calling thread
+static Trace_Ring* create_ring ()
+{
+  ACE_GUARD_RETURN (ACE_Thread_Mutex, guard, trace_lock, NULL);
+
+  Trace_Ring* ring = new Trace_Ring;
+  ring->records = new XIO_Trace_Record[trace_ring_size];
+  ring->mask = trace_ring_size - 1;
+  ring->head = 0;
+  ring->thread = static_cast <uint32_t> (trace_rings.size ());
+  trace_rings.push_back (ring);
+  return ring;
+}
+
+/// Copy the records of all rings
+static void collect (std::vector <XIO_Trace_Record>& records)
+{
+  ACE_GUARD (ACE_Thread_Mutex, guard, trace_lock);
+
+  for (size_t i = 0; i < trace_rings.size (); ++i)
+  {
+    Trace_Ring* ring = trace_rings[i];
+    uint64_t head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t count = head < ring->mask + 1 ? head : ring->mask + 1;
+    for (uint64_t idx = head - count; idx != head; ++idx)
+    {
+      records.push_back (ring->records[idx & ring->mask]);
+    }
+  }
+}
+
+/// The trace hook of the wrappers
+static void trace_hook (int stage, xio_session* session, uint64_t sn, uint64_t timestamp_ns)
+{
+  if (xio_ace_trace_sampled (sn))
+  {
+    xio_ace_trace_record (static_cast <XIO_Trace_Stage> (stage), session, sn,
+                          timestamp_ns != 0 ? timestamp_ns : xio_ace_trace_now ());
+  }
+}
+
+void xio_ace_trace_enable (uint32_t sample_every, size_t ring_size)
+{
+  if (sample_every == 0)
+  {
+    xio_ace_hooks.trace = NULL;
+    xio_ace_trace_sample_mask = ~(uint64_t) 0;
+    return;
+  }
+
+  size_t size = 1;
+  while (size < ring_size)
+  {
+    size <<= 1;
+  }
+  uint64_t rate = 1;
+  while (rate * 2 <= sample_every)
+  {
+    rate <<= 1;
+  }
+
+  {
+    ACE_GUARD (ACE_Thread_Mutex, guard, trace_lock);
+    trace_ring_size = size;
+  }
+  xio_ace_trace_sample_mask = rate - 1;
+  xio_ace_hooks.trace = trace_hook;
+}
+
+uint64_t xio_ace_trace_now ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return static_cast <uint64_t> (ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+void xio_ace_trace_record (XIO_Trace_Stage stage,
+                           xio_session* session,
+                           uint64_t sn,
+                           uint64_t timestamp_ns)
+{
+  if (xio_ace_trace_sample_mask == ~(uint64_t) 0)
+  {
+    return;
+  }
+
+  Trace_Ring* ring = trace_ring;
+  if (ring == NULL)
+  {
+    ring = trace_ring = create_ring ();
+    if (ring == NULL)
+    {
+      return;
+    }
+  }
+
+  uint64_t head = ring->head;
+  XIO_Trace_Record& record = ring->records[head & ring->mask];
+  record.timestamp_ns = timestamp_ns;
+  record.session = reinterpret_cast <uint64_t> (session);
+  record.sn = sn;
+  record.stage = stage;
+  record.thread = ring->thread;
+  __atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+const char* xio_ace_trace_stage_str (XIO_Trace_Stage stage)
+{
+  if (stage < 0 || stage >= XIO_TRACE_STAGES)
+  {
+    return "unknown";
+  }
+  return TRACE_STAGE_NAMES[stage];
+}
+
+long xio_ace_trace_export_binary (const char *path)
+{
+  std::vector <XIO_Trace_Record> records;
+  collect (records);
+
+  FILE* file = fopen (path, "wb");
+  if (file == NULL)
+  {
+    return -1;
+  }
+
+  uint32_t version = 2;
+  uint32_t count = static_cast <uint32_t> (records.size ());
+  bool ok = fwrite ("XIOTRACE", 8, 1, file) == 1 &&
+            fwrite (&version, sizeof (version), 1, file) == 1 &&
+            fwrite (&count, sizeof (count), 1, file) == 1 &&
+            (count == 0 ||
+             fwrite (&records[0], sizeof (XIO_Trace_Record), count, file) == count);
+
+  if (fclose (file) != 0 || !ok)
+  {
+    return -1;
+  }
+  return count;
+}
+
+long xio_ace_trace_export_chrome (const char *path)
+{
+  std::vector <XIO_Trace_Record> records;
+  collect (records);
+
+  FILE* file = fopen (path, "w");
+  if (file == NULL)
+  {
+    return -1;
+  }
+
+  // Instant events, one track per thread, timestamps in microseconds
+  fprintf (file, "{\"traceEvents\":[\n");
+  for (size_t i = 0; i < records.size (); ++i)
+  {
+    const XIO_Trace_Record& record = records[i];
+    fprintf (file,
+             "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":%u,"
+             "\"ts\":%llu.%03llu,\"args\":{\"session\":\"0x%llx\",\"sn\":%llu}}",
+             i == 0 ? "" : ",\n",
+             xio_ace_trace_stage_str (static_cast <XIO_Trace_Stage> (record.stage)),
+             record.thread,
+             (unsigned long long) (record.timestamp_ns / 1000),
+             (unsigned long long) (record.timestamp_ns % 1000),
+             (unsigned long long) record.session,
+             (unsigned long long) record.sn);
+  }
+  fprintf (file, "\n]}\n");
+
+  if (fclose (file) != 0)
+  {
+    return -1;
+  }
+  return static_cast <long> (records.size ());
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2013 Fabrix Systems. All rights reserved.
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XIO_ACE_TRACE_H
+#define XIO_ACE_TRACE_H
+
+#include <libxio.h>
+
+/**
+ * Request latency tracing.
+ *
+ * The wrappers timestamp every stage of a request in a ring buffer
+ * owned by the calling thread (no locks or atomic read-modify-write on
+ * the data path, the oldest records are overwritten). Requests are
+ * sampled by serial number, so client and server tracing with the same
+ * rate record the same requests. Serial numbers are per session, a
+ * request is identified by its session and serial number. The rings
+ * can be exported as a compact binary file or as a Chrome trace
+ * (chrome://tracing) JSON file.
+ */
+
+/// The traced stages of a request
+enum XIO_Trace_Stage
+{
+  /// Client: send_request was called
+  XIO_TRACE_POST = 0,
+  /// Client: xio_send_request returned
+  XIO_TRACE_SEND,
+  /// on_msg_send_complete was called
+  XIO_TRACE_SEND_COMPLETE,
+  /// Server: on_msg was called with the request
+  XIO_TRACE_SERVER_RECEIVE,
+  /// Server: the response was sent with XIO_Server::send_response, or
+  /// a cached one on a hit
+  XIO_TRACE_SERVER_RESPONSE,
+  /// Client: on_msg was called with the response
+  XIO_TRACE_CLIENT_RECEIVE,
+  /// Client: on_msg returned
+  XIO_TRACE_CLIENT_DONE,
+  /// Server: on_msg was called with a request deferred after its receipt
+  XIO_TRACE_SERVER_DISPATCH,
+  XIO_TRACE_STAGES
+};
+
+/// A trace record, as stored in the rings and the binary export
+struct XIO_Trace_Record
+{
+  /// CLOCK_MONOTONIC timestamp in nanoseconds
+  uint64_t timestamp_ns;
+  /// Session of the request (address in the recording process)
+  uint64_t session;
+  /// Serial number of the request
+  uint64_t sn;
+  /// XIO_Trace_Stage
+  uint32_t stage;
+  /// Sequential id of the recording thread
+  uint32_t thread;
+};
+
+/// Sampling mask, tracing is disabled while it is ~0
+extern uint64_t xio_ace_trace_sample_mask;
+
+/**
+ * Enable tracing
+ *
+ * @param sample_every Trace one request of every sample_every (rounded
+ *                     down to a power of 2), 0 disables tracing
+ * @param ring_size Number of records kept per thread (rounded up to a
+ *                  power of 2), used by rings created afterwards
+ */
+void xio_ace_trace_enable (uint32_t sample_every, size_t ring_size);
+
+/// Whether a request is sampled
+inline bool xio_ace_trace_sampled (uint64_t sn)
+{
+  return xio_ace_trace_sample_mask != ~(uint64_t) 0 &&
+         (sn & xio_ace_trace_sample_mask) == 0;
+}
+
+/// Current CLOCK_MONOTONIC time in nanoseconds
+uint64_t xio_ace_trace_now ();
+
+/// Append a record to the calling thread's ring
+void xio_ace_trace_record (XIO_Trace_Stage stage,
+                           xio_session* session,
+                           uint64_t sn,
+                           uint64_t timestamp_ns);
+
+/// Serial number identifying the request a message belongs to
+inline uint64_t xio_ace_trace_sn (xio_msg* msg)
+{
+  return msg->request ? msg->request->sn : msg->sn;
+}
+
+/// Name of a stage
+const char* xio_ace_trace_stage_str (XIO_Trace_Stage stage);
+
+/**
+ * Write all rings to a binary file: the 8 bytes "XIOTRACE", a uint32_t
+ * version (2), a uint32_t record count and the records.
+ *
+ * @return Number of records written, -1 upon error
+ */
+long xio_ace_trace_export_binary (const char *path);
+
+/**
+ * Write all rings as a Chrome trace JSON file
+ *
+ * @return Number of records written, -1 upon error
+ */
+long xio_ace_trace_export_chrome (const char *path);
+
+#endif // XIO_ACE_TRACE_H